@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# Socket activation benchmark: start TASKS tasks, first eagerly and then
+# each behind a listening unix socket, and report for both the time until
+# all of them have started and the resident memory of the processes
+# procman has spawned, then the time a connection takes to activate a task.
+#
+# usage: bench/bench_activation.sh [tasks] [procman options]
+#
+
+TASKS=${1:-1000}
+[ $# -gt 0 ] && shift
+BENCH=$(cd "$(dirname "$0")" && pwd)
+DIR=$(mktemp -d /tmp/bench_activation.XXXXXX)
+
+trap 'rm -rf "$DIR"' EXIT
+
+for mode in eager socket; do
+  i=0
+  while [ $i -lt "$TASKS" ]; do
+    if [ $mode = socket ]; then
+      echo "t$i:once,listen=$DIR/t$i.sock:1::sleep 3600"
+    else
+      echo "t$i:once:1::sleep 3600"
+    fi
+    i=$((i + 1))
+  done > "$DIR/config.txt"
+
+  BEGIN=$(date +%s%N)
+  "$BENCH/../procman" -v "$@" "$DIR/config.txt" 2> "$DIR/log" &
+  PID=$!
+  while ! grep -q "all tasks started" "$DIR/log" 2>/dev/null; do
+    sleep 0.01
+  done
+  END=$(date +%s%N)
+  RSS=$(ps -o rss= --ppid $PID | awk '{ kb += $1 } END { print kb + 0 }')
+
+  ACTIVATE=na
+  if [ $mode = socket ] && command -v python3 > /dev/null; then
+    ACTIVATE=$(python3 - "$DIR/t0.sock" $PID <<'PY'
+import glob, socket, sys, time
+def spawned():  # children of any thread, as shards spawn with -j
+    return any(open(f).read().strip() for f in glob.glob("/proc/%s/task/*/children" % sys.argv[2]))
+begin = time.monotonic()
+socket.socket(socket.AF_UNIX).connect(sys.argv[1])
+while not spawned():
+    time.sleep(0.0001)
+print("%.1f" % ((time.monotonic() - begin) * 1000))
+PY
+)
+  fi
+
+  kill -TERM $PID
+  wait $PID 2>/dev/null
+  echo "bench_activation mode=$mode tasks=$TASKS startup_ms=$(((END - BEGIN) / 1000000)) children_rss_kb=$RSS activate_ms=$ACTIVATE"
+done
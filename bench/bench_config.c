@@ -0,0 +1,155 @@
+/**
+ * OS Assignment #1 Config Parser Benchmark.
+ *
+ * Generates configs of the given numbers of lines, with options, comments,
+ * quoted commands and a few long lines, and times parsing them alone,
+ * loading them into the task pool, and loading them from the compiled
+ * cache of -C.
+ **/
+
+#define main procman_main
+#include "../procman.c"
+#undef main
+
+static double
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int
+write_config (const char *path,
+              int         n)
+{
+  FILE *fp;
+  int   i;
+
+  fp = fopen (path, "w");
+  if (!fp)
+    return -1;
+
+  for (i = 0; i < n; i++)
+  {
+    if (i % 100 == 0)
+      fprintf (fp, "# tasks %d and on\n\n", i);
+    if (i % 1000 == 999)
+      fprintf (fp, "t%d:once:%d::./task -n '%0*d'\n", i, i % 100, 8192, i);
+    else if (i % 3 == 0)
+      fprintf (fp, "  t%d : respawn, max-restarts=5, backoff=200ms, after=t%d : %d : :"
+               " ./task -n \"Task %d\" -t 1\n", i, i ? i - 1 : 1, i % 100, i);
+    else
+      fprintf (fp, "t%d:once:%d::./task -n Task%d -t 1\n", i, i % 100, i);
+  }
+
+  return fclose (fp);
+}
+
+/* time parsing alone and a full load, which compiles the cache, or a
+ * load from that cache. */
+static int
+bench (const char *path,
+       int         n,
+       int         cached)
+{
+  ConfigFile  config;
+  Task        task;
+  char       *line;
+  double      start;
+  double      parse_ms = 0;
+  double      load_ms;
+
+  if (asprintf (&cache_path, "%s.cache", path) < 0)
+    return -1;
+
+  if (!cached)
+  {
+    start = now_ms ();
+    if (open_config (&config, path))
+    {
+      MSG ("failed to open config file '%s': %s\n", path, STRERROR);
+      return -1;
+    }
+    while ((line = next_config_line (&config)) != NULL)
+      parse_task_line (line, config.line_nr, config.indent, &task);
+    close_config (&config);
+    parse_ms = now_ms () - start;
+  }
+
+  start = now_ms ();
+  if (read_config (path))
+  {
+    MSG ("failed to load config file '%s': %s\n", path, STRERROR);
+    return -1;
+  }
+  load_ms = now_ms () - start;
+
+  if (cached)
+    printf ("bench_config lines=%d cache_load_ms=%.3f cache_load_ns_per_line=%.1f tasks=%u\n",
+            n, load_ms, load_ms * 1000000.0 / n, n_tasks);
+  else
+    printf ("bench_config lines=%d parse_ms=%.3f parse_ns_per_line=%.1f"
+            " load_ms=%.3f load_ns_per_line=%.1f tasks=%u\n",
+            n, parse_ms, parse_ms * 1000000.0 / n,
+            load_ms, load_ms * 1000000.0 / n, n_tasks);
+
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const char *sizes[] = { "1000", "100000", "1000000" };
+  const char       **size = sizes;
+  int                n_sizes = 3;
+  int                i;
+
+  if (argc > 1)
+  {
+    size = (const char **) argv + 1;
+    n_sizes = argc - 1;
+  }
+
+  for (i = 0; i < n_sizes; i++)
+  {
+    char path[] = "/tmp/bench_config.XXXXXX";
+    char cache[sizeof (path) + 6];
+    int  n = atoi (size[i]);
+    int  cached;
+    int  fd;
+
+    fd = mkstemp (path);
+    if (fd < 0 || close (fd) || write_config (path, n))
+    {
+      MSG ("failed to create config: %s\n", STRERROR);
+      return -1;
+    }
+    snprintf (cache, sizeof (cache), "%s.cache", path);
+
+    /* each run in a child of its own, to start from an empty pool */
+    for (cached = 0; cached < 2; cached++)
+    {
+      pid_t pid;
+      int   status;
+
+      fflush (stdout);
+      pid = fork ();
+      if (pid < 0)
+        return -1;
+      if (pid == 0)
+        exit (bench (path, n, cached) ? 1 : 0);
+      if (waitpid (pid, &status, 0) < 0 || status)
+        break;
+    }
+
+    unlink (path);
+    unlink (cache);
+    if (cached < 2)
+      return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Dependency scheduler benchmark: report the startup makespan of wide,
+# deep and layered DAGs, i.e. the time until every task has executed.
+#
+# usage: bench/bench_dag.sh [tasks] [procman options]
+#
+
+N=${1:-1000}
+[ $# -gt 0 ] && shift
+BENCH=$(cd "$(dirname "$0")" && pwd)
+CONFIG=$(mktemp /tmp/bench_dag.XXXXXX)
+
+trap 'rm -f "$CONFIG"' EXIT
+
+for shape in wide deep layered; do
+  "$BENCH/gen_dag.sh" $shape "$N" 10 > "$CONFIG"
+  "$BENCH/../procman" -v "$@" "$CONFIG" 2>&1 |
+    awk -v shape=$shape -v n="$N" '/^all tasks started in/ {
+      printf "bench_dag shape=%s tasks=%d makespan_ms=%d\n", shape, n, $5
+    }'
+done
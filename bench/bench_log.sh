@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Log benchmark: TASKS tasks each write SIZE bytes in lines of 64 bytes,
+# captured by procman into one combined log, and report the throughput.
+#
+# usage: bench/bench_log.sh [tasks] [size]
+#
+
+TASKS=${1:-16}
+SIZE=${2:-64M}
+BENCH=$(cd "$(dirname "$0")" && pwd)
+CONFIG=$(mktemp /tmp/bench_log.XXXXXX)
+LOG=$(mktemp /tmp/bench_log.XXXXXX)
+
+trap 'rm -f "$CONFIG" "$LOG" "$LOG.1"' EXIT
+
+i=0
+while [ $i -lt $TASKS ]; do
+  echo "t$i:once:1::$BENCH/../task -n t$i -s $SIZE"
+  i=$((i + 1))
+done > "$CONFIG"
+
+start=$(date +%s.%N)
+"$BENCH/../procman" -l "$LOG" "$CONFIG"
+end=$(date +%s.%N)
+
+lines=$(wc -l < "$LOG")
+bytes=$(wc -c < "$LOG")
+awk -v tasks=$TASKS -v lines=$lines -v bytes=$bytes -v start=$start -v end=$end 'BEGIN {
+  s = end - start
+  printf "bench_log tasks=%d lines=%d seconds=%.3f lines_per_sec=%.0f mb_per_sec=%.1f\n",
+    tasks, lines, s, lines / s, bytes / s / 1048576
+}'
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# Metrics benchmark: scrape procman SCRAPES times while it supervises TASKS
+# tasks, one of them respawning as fast as it can, and report the time of
+# a scrape and how long the event loop and the respawns were held up.
+#
+# usage: bench/bench_metrics.sh [tasks] [scrapes]
+#
+
+TASKS=${1:-10000}
+SCRAPES=${2:-100}
+DIR=$(mktemp -d /tmp/bench_metrics.XXXXXX)
+BENCH=$(cd "$(dirname "$0")" && pwd)
+
+trap 'rm -rf "$DIR"' EXIT
+
+# every task but the respawning one waits for a task which never starts
+{
+  echo "churn:respawn,backoff=0:1::/bin/true"
+  echo "never:once,after=never:1::/bin/true"
+  i=2
+  while [ $i -lt "$TASKS" ]; do
+    echo "t$i:once,requires=never:1::/bin/true"
+    i=$((i + 1))
+  done
+} > "$DIR/config.txt"
+
+"$BENCH/../procman" -m "$DIR/metrics.sock" "$DIR/config.txt" 2>/dev/null &
+PID=$!
+
+while [ ! -S "$DIR/metrics.sock" ]; do
+  sleep 0.1
+done
+
+i=0
+while [ $i -lt "$SCRAPES" ]; do
+  "$BENCH/scrape" "$DIR/metrics.sock" > "$DIR/metrics.txt"
+  tail -n 1 "$DIR/metrics.txt"
+  i=$((i + 1))
+done > "$DIR/scrapes.txt"
+
+kill -TERM $PID
+wait $PID 2>/dev/null
+
+# the upper bound of the bucket holding the 99th percentile
+awk -v tasks=$TASKS -v scrapes=$SCRAPES -v bytes=$(wc -c < "$DIR/metrics.txt") '
+  FILENAME ~ /scrapes/ { sum += $3; if ($3 > max) max = $3; next }
+  /_bucket/ {
+    split ($0, f, "\"")
+    name = substr ($1, 1, index ($1, "_bucket") - 1)
+    le[name, ++n[name]] = f[2]
+    count[name, n[name]] = $2
+  }
+  function p99 (name,    i) {
+    for (i = 1; i <= n[name]; i++)
+      if (count[name, i] >= 0.99 * count[name, n[name]])
+        return le[name, i]
+  }
+  END {
+    printf "bench_metrics tasks=%d scrapes=%d bytes=%d scrape_ms_avg=%.2f scrape_ms_max=%.2f loop_lag_p99_le=%s respawn_latency_p99_le=%s\n",
+      tasks, scrapes, bytes, sum / scrapes / 1000, max / 1000,
+      p99("procman_loop_lag_seconds"), p99("procman_respawn_latency_seconds")
+  }' "$DIR/scrapes.txt" "$DIR/metrics.txt"
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Pipeline benchmark: stream SIZE bytes through pipelines of 2, 4 and 8
+# stages, with the default pipe buffers and with PIPE_SIZE ones, and
+# report the end-to-end throughput.
+#
+# usage: bench/bench_pipeline.sh [size] [pipe-size]
+#
+
+SIZE=${1:-1G}
+PIPE_SIZE=${2:-1M}
+BENCH=$(cd "$(dirname "$0")" && pwd)
+CONFIG=$(mktemp /tmp/bench_pipeline.XXXXXX)
+
+trap 'rm -f "$CONFIG"' EXIT
+
+for stages in 2 4 8; do
+  for size in default $PIPE_SIZE; do
+    option=
+    [ $size != default ] && option=",pipe-size=$size"
+    {
+      echo "s1:once$option:1::$BENCH/../task -n s1 -s $SIZE"
+      i=2
+      while [ $i -lt $stages ]; do
+        echo "s$i:once,pipe-from=s$((i - 1))$option:1::$BENCH/../task -n s$i -c"
+        i=$((i + 1))
+      done
+      echo "s$stages:once,pipe-from=s$((stages - 1)):1::$BENCH/../task -n s$stages -d"
+    } > "$CONFIG"
+    "$BENCH/../procman" "$CONFIG" 2>&1 |
+      awk -v stages=$stages -v size=$size '/drained/ {
+        printf "bench_pipeline stages=%d pipe_size=%s bytes=%s seconds=%s mb_per_sec=%s\n",
+          stages, size, $3, $6, substr ($8, 2)
+      }'
+  done
+done
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Respawn benchmark: supervise trivial 'respawn' tasks until SPAWNS children
+# have been started, then report the reap-to-respawn latency. The latency
+# is 'na' when they are not all started within WAIT seconds.
+#
+# usage: bench/bench_respawn.sh [spawns] [tasks]
+#
+
+SPAWNS=${1:-10000}
+TASKS=${2:-10}
+WAIT=60
+DIR=$(mktemp -d /tmp/bench_respawn.XXXXXX)
+BENCH=$(cd "$(dirname "$0")" && pwd)
+
+trap 'rm -rf "$DIR"' EXIT
+
+i=0
+while [ $i -lt "$TASKS" ]; do
+  echo "r$i:respawn,backoff=0:1::$BENCH/stamp $DIR/r$i.log"
+  i=$((i + 1))
+done > "$DIR/config.txt"
+
+"$BENCH/../procman" "$DIR/config.txt" &
+PID=$!
+
+# bounded, in case the spawns fail or procman is gone
+n=0
+while [ "$(cat "$DIR"/*.log 2>/dev/null | grep -c start)" -lt "$SPAWNS" ] &&
+      [ $n -lt $((WAIT * 10)) ] && kill -0 $PID 2>/dev/null; do
+  sleep 0.1
+  n=$((n + 1))
+done
+kill -TERM $PID 2>/dev/null
+wait $PID 2>/dev/null
+
+STARTED=$(cat "$DIR"/*.log 2>/dev/null | grep -c start)
+if [ "$STARTED" -lt "$SPAWNS" ]; then
+  echo "bench_respawn spawns=$SPAWNS tasks=$TASKS started=$STARTED mean_us=na p50_us=na p99_us=na max_us=na"
+  exit 0
+fi
+
+# latency of every exit -> next start pair, per task
+for log in "$DIR"/*.log; do
+  awk '$1 == "exit" { e = $2 } $1 == "start" && e { print $2 - e; e = 0 }' "$log"
+done | sort -n | awk -v spawns="$SPAWNS" -v tasks="$TASKS" '
+  { v[NR] = $1; sum += $1 }
+  END {
+    if (!NR) exit 1;
+    printf "bench_respawn spawns=%d tasks=%d samples=%d mean_us=%.1f p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+      spawns, tasks, NR, sum / NR / 1000, v[int(NR * 0.50) + 1] / 1000,
+      v[int(NR * 0.99) + 1] / 1000, v[NR] / 1000
+  }'
@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Shutdown benchmark: start TASKS tasks over ten orders, one in a hundred
+# ignoring SIGTERM, then send procman SIGTERM and report how long it took
+# to stop them all, with a stop-timeout of 1s for every task and a
+# shutdown deadline of 5s.
+#
+# usage: bench/bench_shutdown.sh [tasks] [procman options]
+#
+
+TASKS=${1:-1000}
+[ $# -gt 0 ] && shift
+BENCH=$(cd "$(dirname "$0")" && pwd)
+DIR=$(mktemp -d /tmp/bench_shutdown.XXXXXX)
+
+trap 'rm -rf "$DIR"' EXIT
+
+i=0
+while [ $i -lt "$TASKS" ]; do
+  if [ $((i % 100)) -eq 0 ]; then
+    echo "t$i:once,stop-timeout=1s:$((i % 10 + 1))::sh -c 'trap \"\" TERM; while :; do sleep 1; done'"
+  else
+    echo "t$i:once,stop-timeout=1s:$((i % 10 + 1))::sleep 3600"
+  fi
+  i=$((i + 1))
+done > "$DIR/config.txt"
+
+"$BENCH/../procman" -v -k 5s "$@" "$DIR/config.txt" 2> "$DIR/log" &
+PID=$!
+while ! grep -q "all tasks started" "$DIR/log" 2>/dev/null; do
+  sleep 0.1
+done
+
+BEGIN=$(date +%s%N)
+kill -TERM $PID
+wait $PID 2>/dev/null
+END=$(date +%s%N)
+
+awk -v tasks="$TASKS" -v ms=$(((END - BEGIN) / 1000000)) '
+/^all tasks stopped/ { killed = $7 }
+END {
+  printf "bench_shutdown tasks=%d stop_ms=%d killed=%d\n", tasks, ms, killed
+}' "$DIR/log"
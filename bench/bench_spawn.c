@@ -0,0 +1,103 @@
+/**
+ * OS Assignment #1 Spawn Backend Benchmark.
+ *
+ * Measures spawns per second of each spawn backend while procman holds a
+ * given amount of resident memory.
+ **/
+
+#define main procman_main
+#include "../procman.c"
+#undef main
+
+static double
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double
+bench_backend (SpawnBackend backend,
+               int          spawns)
+{
+  Task        *task;
+  TaskChunk   *chunk;
+  unsigned int index;
+  double       start;
+  int          i;
+
+  /* a slot of the pool, as set_task_pid() keeps the pids by chunk */
+  task = alloc_task (&chunk, &index);
+  if (!task)
+  {
+    MSG ("failed to allocate a task: %s\n", STRERROR);
+    exit (-1);
+  }
+  memset (task, 0x00, sizeof (*task));
+  task->chunk = chunk;
+  task->index = index;
+  task->stdin_fd = -1;                  // as append_task() leaves them
+  task->stdout_fd = -1;
+  task->log_watch.fd = -1;
+  task->exit_watch.fd = -1;
+  task->listen_watch.fd = -1;
+  task->log_fd = -1;
+  task->status = -1;
+  task->cgroup_fd = -1;
+  strcpy (task->id, "bench");
+  task->command = "/bin/true";
+  task->argv = parse_command_argv (task->command);
+  spawn_backend = backend;
+
+  start = now_ms ();
+  for (i = 0; i < spawns; i++)
+  {
+    spawn_task (task);
+    if (task->pid > 0)
+      waitpid (task->pid, NULL, 0);
+    if (task->state == TASK_STARTING)
+      finish_start (task);
+    set_task_pid (task, 0);
+  }
+
+  return spawns * 1000.0 / (now_ms () - start);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  static const int sizes[] = { 10, 100, 1024 };
+  int              spawns;
+  int              i;
+
+  spawns = argc > 1 ? atoi (argv[1]) : 1000;
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+
+  for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+  {
+    size_t len = (size_t) sizes[i] << 20;
+    char  *ballast;
+
+    /* touch every page so it is resident and mapped */
+    ballast = malloc (len);
+    if (!ballast)
+    {
+      MSG ("failed to allocate %d MB: %s\n", sizes[i], STRERROR);
+      return -1;
+    }
+    memset (ballast, 0x5a, len);
+
+    printf ("bench_spawn rss_mb=%d backend=fork spawns_per_sec=%.0f\n",
+            sizes[i], bench_backend (SPAWN_FORK, spawns));
+    printf ("bench_spawn rss_mb=%d backend=spawn spawns_per_sec=%.0f\n",
+            sizes[i], bench_backend (SPAWN_POSIX, spawns));
+    fflush (stdout);
+
+    free (ballast);
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+#!/bin/sh
+#
+# Startup and spawn benchmark: supervise TASKS no-op tasks in each config
+# shape and report, one machine-readable line per shape, the time until
+# every task has started, the spawn rate, the reap-to-respawn latency and
+# the CPU time of procman itself.
+#
+#   once     every task runs once, in one order
+#   respawn  every task respawns as fast as it can, for SECONDS
+#   pairs    tasks run once, piped by pairs
+#   mixed    ten orders, one task in four respawning, for SECONDS
+#
+# Values which do not apply to a shape are 'na', and so is started_ms when
+# not every task started within WAIT seconds.
+#
+# usage: bench/bench_startup.sh [tasks] [seconds] [procman options]
+#
+
+TASKS=${1:-1000}
+SECONDS_RUN=${2:-2}
+shift $(( $# < 2 ? $# : 2 ))
+WAIT=30
+DIR=$(mktemp -d /tmp/bench_startup.XXXXXX)
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TICK=$(getconf CLK_TCK)
+
+trap 'rm -rf "$DIR"' EXIT
+
+config ()
+{
+  i=0
+  while [ $i -lt "$TASKS" ]; do
+    case $1 in
+    once)
+      echo "t$i:once:1::$BENCH/stamp $DIR/t$i.log" ;;
+    respawn)
+      echo "t$i:respawn,backoff=0:1::$BENCH/stamp $DIR/t$i.log" ;;
+    pairs)
+      if [ $((i % 2)) -eq 0 ]; then
+        echo "t$i:once:1::$BENCH/stamp $DIR/t$i.log"
+      else
+        echo "t$i:once:1:t$((i - 1)):$BENCH/stamp $DIR/t$i.log"
+      fi ;;
+    mixed)
+      if [ $((i % 4)) -eq 0 ]; then
+        echo "t$i:respawn,backoff=0:$((i % 10 + 1))::$BENCH/stamp $DIR/t$i.log"
+      else
+        echo "t$i:once:$((i % 10 + 1))::$BENCH/stamp $DIR/t$i.log"
+      fi ;;
+    esac
+    i=$((i + 1))
+  done
+  # keeps procman up once the other tasks are done
+  echo "hold:once:1::sleep 3600"
+}
+
+for shape in once respawn pairs mixed; do
+  rm -f "$DIR"/*.log "$DIR/begin" "$DIR/end"
+  config $shape > "$DIR/config.txt"
+
+  "$BENCH/stamp" "$DIR/begin"
+  "$BENCH/../procman" "$@" "$DIR/config.txt" 2>/dev/null &
+  PID=$!
+
+  case $shape in
+  respawn|mixed)
+    sleep "$SECONDS_RUN" ;;
+  *)
+    # bounded, in case some task never starts or procman is gone
+    n=0
+    while [ "$(cat "$DIR"/t*.log 2>/dev/null | grep -c start)" -lt "$TASKS" ] &&
+          [ $n -lt $((WAIT * 10)) ] && kill -0 $PID 2>/dev/null; do
+      sleep 0.1
+      n=$((n + 1))
+    done ;;
+  esac
+
+  "$BENCH/stamp" "$DIR/end"
+  CPU=$(awk -v tick="$TICK" '{ print ($14 + $15) * 1000 / tick }' /proc/$PID/stat 2>/dev/null)
+  kill -TERM $PID 2>/dev/null
+  wait $PID 2>/dev/null
+
+  # the first start of every task, then every exit -> next start pair
+  for log in "$DIR"/t*.log; do
+    [ -f "$log" ] || continue
+    awk '$1 == "start" && !n++ { print "first", $2 }
+         $1 == "exit" { e = $2 }
+         $1 == "start" && e { print "respawn", $2 - e; e = 0 }' "$log"
+  done | sort -k 2 -n | awk -v shape=$shape -v tasks="$TASKS" -v cpu="${CPU:-0}" \
+      -v begin="$(awk '$1 == "start" { print $2 }' "$DIR/begin")" \
+      -v end="$(awk '$1 == "start" { print $2 }' "$DIR/end")" '
+    $1 == "first" { started++; if ($2 > last) last = $2 }
+    $1 == "respawn" { v[++n] = $2 }
+    END {
+      wall = end - begin
+      if ((shape == "once" || shape == "pairs") && started)
+        wall = last - begin
+      printf "bench_startup shape=%s tasks=%d started=%d started_ms=%s spawns=%d spawns_per_sec=%.0f",
+        shape, tasks, started, started == tasks ? sprintf ("%.1f", (last - begin) / 1e6) : "na",
+        NR, NR / (wall / 1e9)
+      if (n)
+        printf " respawn_p50_us=%.1f respawn_p99_us=%.1f",
+          v[int(n * 0.50) + 1] / 1000, v[int(n * 0.99) + 1] / 1000
+      else
+        printf " respawn_p50_us=na respawn_p99_us=na"
+      printf " cpu_ms=%d cpu_pct=%.1f\n", cpu, cpu * 1e8 / (end - begin)
+    }'
+done
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Syscall benchmark: respawn TASKS no-op tasks for SECONDS under each event
+# loop backend, and report the system calls made by procman's event loop
+# per spawned task, counted with ptrace.
+#
+# usage: bench/bench_syscalls.sh [tasks] [seconds] [procman options]
+#
+
+TASKS=${1:-100}
+SECONDS_RUN=${2:-2}
+shift $(( $# < 2 ? $# : 2 ))
+BENCH=$(cd "$(dirname "$0")" && pwd)
+CONFIG=$(mktemp /tmp/bench_syscalls.XXXXXX)
+
+trap 'rm -f "$CONFIG"' EXIT
+
+i=0
+while [ $i -lt "$TASKS" ]; do
+  echo "t$i:respawn,backoff=0:1::true"
+  i=$((i + 1))
+done > "$CONFIG"
+
+for backend in epoll uring; do
+  "$BENCH/syscalls" "$SECONDS_RUN" "$BENCH/../procman" -e $backend "$@" "$CONFIG" 2>/dev/null |
+    awk -v backend=$backend -v tasks="$TASKS" -F '[ =]' '{
+      printf "bench_syscalls backend=%s tasks=%d spawns=%d syscalls=%d syscalls_per_spawn=%.2f\n",
+        backend, tasks, $4, $2, $4 ? $2 / $4 : 0
+    }'
+done
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Tap benchmark: stream SIZE bytes between a piped pair of tasks, once
+# directly and once through a tapped relay, and report the throughput.
+#
+# usage: bench/bench_tap.sh [size] [tap-file]
+#
+
+SIZE=${1:-1G}
+TAP=${2:-/dev/null}
+BENCH=$(cd "$(dirname "$0")" && pwd)
+CONFIG=$(mktemp /tmp/bench_tap.XXXXXX)
+
+trap 'rm -f "$CONFIG"' EXIT
+
+for mode in direct tap; do
+  option=
+  [ $mode = tap ] && option=",tap=$TAP"
+  cat > "$CONFIG" <<END
+src:once$option:1::$BENCH/../task -n src -s $SIZE
+dst:once:1:src:$BENCH/../task -n dst -d
+END
+  "$BENCH/../procman" "$CONFIG" 2>&1 |
+    awk -v mode=$mode '/drained/ {
+      printf "bench_tap mode=%s bytes=%s seconds=%s mb_per_sec=%s\n",
+        mode, $3, $6, substr ($8, 2)
+    }'
+done
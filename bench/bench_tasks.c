@@ -0,0 +1,76 @@
+/**
+ * OS Assignment #1 Task Pool Benchmark.
+ *
+ * Loads a generated config into the task pool and scans it the way the
+ * main loop does.
+ **/
+
+#define main procman_main
+#include "../procman.c"
+#undef main
+
+static double
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  char    path[] = "/tmp/bench_tasks.XXXXXX";
+  FILE   *fp;
+  int     fd;
+  int     n;
+  int     i;
+  int     scans;
+  double  start;
+  double  load_ms;
+  double  scan_ms;
+
+  n = argc > 1 ? atoi (argv[1]) : 100000;
+  scans = argc > 2 ? atoi (argv[2]) : 100;
+
+  fd = mkstemp (path);
+  if (fd < 0 || !(fp = fdopen (fd, "w")))
+  {
+    MSG ("failed to create config: %s\n", STRERROR);
+    return -1;
+  }
+  for (i = 0; i < n; i++)
+    fprintf (fp, "t%d:%s:%d::./task -n Task%d -t 1\n",
+             i, i % 2 ? "once" : "respawn", i % 100, i);
+  fclose (fp);
+
+  start = now_ms ();
+  if (read_config (path))
+  {
+    MSG ("failed to load config file '%s': %s\n", path, STRERROR);
+    unlink (path);
+    return -1;
+  }
+  load_ms = now_ms () - start;
+  unlink (path);
+
+  /* same walk as terminate_children() */
+  start = now_ms ();
+  for (i = 0; i < scans; i++)
+  {
+    TaskChunk   *chunk;
+    Task        *task;
+    unsigned int j;
+
+    FOR_EACH_LIVE_TASK (chunk, j, task)
+      kill (task->pid, 0);
+  }
+  scan_ms = (now_ms () - start) / scans;
+
+  printf ("bench_tasks tasks=%u load_ms=%.3f scan_ms=%.3f scan_ns_per_task=%.3f\n",
+          n_tasks, load_ms, scan_ms, scan_ms * 1000000.0 / (n_tasks ? n_tasks : 1));
+
+  return 0;
+}
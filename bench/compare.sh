@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Compare two outputs of 'make bench', before and after a change, and
+# print every result that got worse by more than THRESHOLD percent.
+# Lines are matched by benchmark name and parameters; times (_ms, _us,
+# _ns, seconds), sizes (_kb), _pct and _per_spawn are better lower,
+# _per_sec higher.
+# Exits with 1 if anything regressed.
+#
+# usage: bench/compare.sh old.txt new.txt [threshold]
+#
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 old.txt new.txt [threshold]" >&2
+  exit 2
+fi
+
+awk -v threshold="${3:-10}" '
+function metric(k)
+{
+  if (k ~ /per_sec$/)
+    return 1;                   # higher is better
+  if (k ~ /(_ms|_us|_ns|_pct|_kb)(_|$)/ || k ~ /_ns_per_|_per_spawn$/ || k == "seconds")
+    return -1;                  # lower is better
+  return 0;
+}
+
+# counts which vary from run to run and so cannot identify a line
+function counted(k)
+{
+  return k == "started" || k == "spawns" || k == "samples" || k == "syscalls" ||
+         k == "bytes" && $1 == "bench_metrics";
+}
+
+/^bench_/ {
+  key = $1;
+  for (i = 2; i <= NF; i++)
+    {
+      split($i, kv, "=");
+      if (!metric(kv[1]) && !counted(kv[1]))
+        key = key " " $i;
+    }
+  for (i = 2; i <= NF; i++)
+    {
+      split($i, kv, "=");
+      if (!metric(kv[1]) || kv[2] == "na")
+        continue;
+      if (FILENAME == ARGV[1])
+        {
+          old[key SUBSEP kv[1]] = kv[2];
+          continue;
+        }
+      if (!((key SUBSEP kv[1]) in old))
+        continue;
+      was = old[key SUBSEP kv[1]];
+      if (was == 0)
+        continue;
+      change = (kv[2] - was) / was * 100 * -metric(kv[1]);
+      if (change > threshold)
+        {
+          printf "%s %s: %s -> %s (%.1f%% worse)\n", key, kv[1], was, kv[2], change;
+          worse++;
+        }
+    }
+}
+
+END {
+  exit worse > 0;
+}
+' "$1" "$2"
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Generate a config whose tasks form a dependency DAG.
+#
+# usage: bench/gen_dag.sh wide|deep|layered N [width] [command]
+#
+#   wide     one root and N-1 tasks after it
+#   deep     a chain of N tasks, each after the previous one
+#   layered  N tasks in layers of 'width', each after two tasks of the
+#            previous layer
+#
+
+SHAPE=$1
+N=${2:-1000}
+WIDTH=${3:-10}
+COMMAND=${4:-/bin/true}
+
+awk -v shape="$SHAPE" -v n="$N" -v width="$WIDTH" -v cmd="$COMMAND" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    after = "";
+    if (shape == "wide" && i > 0)
+      after = ",after=t0";
+    else if (shape == "deep" && i > 0)
+      after = ",after=t" (i - 1);
+    else if (shape == "layered" && i >= width) {
+      base = i - i % width - width;
+      after = ",after=t" (base + i % width) "+t" (base + (i + 1) % width);
+    } else if (shape != "wide" && shape != "deep" && shape != "layered") {
+      print "unknown shape " shape > "/dev/stderr";
+      exit 1;
+    }
+    printf "t%d:once%s:1::%s\n", i, after, cmd;
+  }
+}'
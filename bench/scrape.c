@@ -0,0 +1,57 @@
+/**
+ * OS Assignment #1 Benchmark Client.
+ *
+ * Reads the metrics of procman from its socket once, and prints them with
+ * the time the scrape took (CLOCK_MONOTONIC, in us) on the last line.
+ **/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static long long
+now_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  struct sockaddr_un addr;
+  char               buf[65536];
+  long long          start;
+  ssize_t            len;
+  int                fd;
+
+  if (argc < 2 || strlen (argv[1]) >= sizeof (addr.sun_path))
+  {
+    fprintf (stderr, "usage: %s socket\n", argv[0]);
+    return -1;
+  }
+
+  memset (&addr, 0x00, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, argv[1]);
+
+  start = now_us ();
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect (fd, (struct sockaddr *) &addr, sizeof (addr)))
+  {
+    perror ("connect");
+    return -1;
+  }
+
+  while ((len = read (fd, buf, sizeof (buf))) > 0)
+    fwrite (buf, 1, len, stdout);
+  printf ("# scrape_us %lld\n", now_us () - start);
+
+  return len < 0 ? -1 : 0;
+}
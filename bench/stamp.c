@@ -0,0 +1,48 @@
+/**
+ * OS Assignment #1 Benchmark Task.
+ *
+ * Appends its start and exit time (CLOCK_MONOTONIC, in ns) to a file and
+ * exits right away, so the gap between one exit and the next start is the
+ * supervisor's reap-to-respawn latency.
+ **/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+static void
+stamp (int fd, const char *what)
+{
+  struct timespec ts;
+  char            line[64];
+  int             len;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  len = snprintf (line, sizeof (line), "%s %lld\n", what,
+                  (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec);
+  write (fd, line, len);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int fd;
+
+  if (argc < 2)
+  {
+    fprintf (stderr, "usage: %s file\n", argv[0]);
+    return -1;
+  }
+
+  fd = open (argv[1], O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+    return -1;
+
+  stamp (fd, "start");
+  stamp (fd, "exit");
+
+  return 0;
+}
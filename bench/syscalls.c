@@ -0,0 +1,99 @@
+/**
+ * OS Assignment #1 Benchmark Tracer.
+ *
+ * Runs a command under ptrace(2) for some seconds, then sends it SIGTERM,
+ * and prints how many system calls its main thread made until it exited,
+ * and how many of them cloned a process. Threads and children of the
+ * command are not traced.
+ **/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static volatile sig_atomic_t expired;
+
+static void
+handle_alarm (int signo)
+{
+  expired = 1;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  struct __ptrace_syscall_info info;
+  struct sigaction             sa;
+  unsigned long                syscalls = 0;
+  unsigned long                clones = 0;
+  pid_t                        pid;
+  int                          status;
+  int                          signo;
+
+  if (argc < 3)
+  {
+    fprintf (stderr, "usage: %s seconds command [args...]\n", argv[0]);
+    return -1;
+  }
+
+  pid = fork ();
+  if (pid == 0)
+  {
+    ptrace (PTRACE_TRACEME, 0, NULL, NULL);
+    execvp (argv[2], argv + 2);
+    exit (-1);
+  }
+
+  /* stopped by its exec */
+  if (pid < 0 || waitpid (pid, &status, 0) < 0 || !WIFSTOPPED (status))
+    return -1;
+  ptrace (PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+
+  memset (&sa, 0x00, sizeof (sa));
+  sa.sa_handler = handle_alarm;
+  sigaction (SIGALRM, &sa, NULL);
+  alarm (atoi (argv[1]));
+
+  signo = 0;
+  for (;;)
+  {
+    if (ptrace (PTRACE_SYSCALL, pid, NULL, signo) < 0)
+      break;
+    while (waitpid (pid, &status, 0) < 0)
+      if (errno != EINTR)
+        return -1;
+    if (expired)
+    {
+      expired = 0;
+      kill (pid, SIGTERM);
+    }
+    if (WIFEXITED (status) || WIFSIGNALED (status))
+      break;
+
+    signo = 0;
+    if (WSTOPSIG (status) != (SIGTRAP | 0x80))
+    {
+      signo = WSTOPSIG (status);        // a signal, passed on
+      continue;
+    }
+
+    if (ptrace (PTRACE_GET_SYSCALL_INFO, pid, sizeof (info), &info) < 0 ||
+        info.op != PTRACE_SYSCALL_INFO_ENTRY)
+      continue;
+    syscalls++;
+    if (info.entry.nr == SYS_clone || info.entry.nr == SYS_clone3 ||
+        info.entry.nr == SYS_fork || info.entry.nr == SYS_vfork)
+      clones++;
+  }
+
+  printf ("syscalls=%lu clones=%lu\n", syscalls, clones);
+
+  return 0;
+}
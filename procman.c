@@ -2,25 +2,77 @@
  * OS Assignment #1
  **/
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <signal.h>
+#include <spawn.h>
 #include <sys/signalfd.h>             // [new] for signalfd
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdarg.h>
 #include <time.h>                     // [new] for rand() function
 
 #define MSG(x...) fprintf (stderr, x)
 #define STRERROR  strerror (errno)
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 #define ID_MIN 2
 #define ID_MAX 8
 #define ORDER_MIN 1
 #define ORDER_MAX 4
-#define COMMAND_LEN 256
+#define ORDER_LIMIT 10000               // orders have at most ORDER_MAX digits
+#define HASH_SIZE_MIN 64
+#define TASK_CHUNK_SIZE 1024
+#define STRING_CHUNK_SIZE 65536
+#define EVENT_BATCH 64
+#define URING_ENTRIES 1024              // submission ring of the io_uring loop
+#define URING_NO_WATCH (~0ULL)          // user_data of requests with no watch
+#define RELAY_CHUNK (1 << 20)           // most bytes moved by one splice
+#define RESTART_WINDOW 10000            // default restart window in ms
+#define RESTART_BACKOFF 100             // default first backoff delay in ms
+#define RESTART_BACKOFF_MAX 30000       // default longest backoff delay in ms
+#define STOP_TIMEOUT 5000               // default time a task gets to stop, in ms
+#define SHUTDOWN_TIMEOUT 30000          // default time every task gets to stop, in ms
+#define LISTEN_BACKLOG 128              // connections queued until a task accepts them
+#define LISTEN_FDS_START 3              // fd the socket is passed on as
+#define IDLE_CHECK 1000                 // interval of the idle checks, in ms
+#define LOG_CHUNK 65536                 // log lines handed to the writer at once
+#define LOG_CHUNKS_MAX 256              // chunks queued before capture pauses
+#define LOG_LINE_MAX 4096               // longer output lines are split
+#define LOG_IOV 64                      // chunks written by one writev()
+#define METRICS_CLIENTS_MAX 64          // scrapes served at once
+#define METRICS_SLICE 256               // tasks formatted for a scrape at a time
+#define METRICS_BUF (METRICS_SLICE * 256)
+#define HISTOGRAM_BUCKETS 7
+#define RELOAD_DIRTY 1                  // to be stopped, then redefined or removed
+#define RELOAD_DEFINED 2                // has a new definition
+#define RELOAD_REMOVE 4                 // its line is gone from the config
+#define RELOAD_APPLIED 8                // redefined by the current reload
+#define RELOAD_STOPPING 16              // its old process has not exited yet
 
 
 
@@ -31,48 +83,824 @@ typedef enum
 
 } Action;
 
+typedef enum
+{
+  TASK_IDLE,                            // not started, or exited for good
+  TASK_STARTING,                        // has a live pid, not executed yet
+  TASK_RUNNING,                         // has a live pid
+  TASK_BACKOFF,                         // waiting for a delayed respawn
+  TASK_FAILED,                          // respawned too often, given up
+  TASK_LISTENING,                       // waiting for a connection to its socket
+
+} TaskState;
+
+typedef enum
+{
+  SPAWN_FORK,                           // fork() and exec in the child
+  SPAWN_POSIX,                          // posix_spawnp(), a vfork-style clone
+
+} SpawnBackend;
+
+typedef enum
+{
+  LOOP_EPOLL,                           // epoll_wait(), one epoll_ctl() per change
+  LOOP_URING,                           // io_uring polls, submitted with the wait
+
+} LoopBackend;
+
+/* an fd registered in the event loop, passed back to its handler. */
+typedef struct _Watch Watch;
+typedef void (*WatchFunc) (Watch *watch, unsigned int events);
+struct _Watch
+{
+  int            fd;
+  WatchFunc      func;
+  unsigned int   events;                // io_uring loop: events polled for
+  unsigned int   slot;                  // io_uring loop: its slot + 1, 0 for none
+};
+
+/* a watch of the io_uring loop. a poll names its slot and generation, so
+ * that the completion of a poll which has been removed is ignored, even
+ * once the watch has been freed or the slot reused. */
+typedef struct _UringSlot UringSlot;
+struct _UringSlot
+{
+  Watch         *watch;                 // NULL while free
+  unsigned int   gen;                   // bumped when a poll is removed
+  unsigned int   next_free;
+  int            armed;                 // 1 while a poll is pending
+};
+
+/* the rings shared with the kernel, see io_uring_setup(2). */
+typedef struct _Uring Uring;
+struct _Uring
+{
+  int            fd;
+  unsigned int  *sq_head;
+  unsigned int  *sq_tail;
+  unsigned int   sq_mask;
+  unsigned int   sq_entries;
+  unsigned int  *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned int  *cq_head;
+  unsigned int  *cq_tail;
+  unsigned int   cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned int   to_submit;             // queued, not submitted yet
+  UringSlot     *slots;
+  unsigned int   n_slots;
+  unsigned int   free_slot;             // first free slot + 1, 0 for none
+  unsigned int   fired[EVENT_BATCH];    // slots to poll again after a turn
+  unsigned int   n_fired;
+};
+
 typedef struct _Task Task;
-struct _Task
+typedef struct _TaskChunk TaskChunk;
+
+/* an edge from a task to one which depends on it. */
+typedef struct _Dependent Dependent;
+struct _Dependent
+{
+  Task          *task;                  // the task which depends
+  int            required;              // 1 for 'requires=', 0 for 'after='
+};
+
+/* one direction of a tapped pipe pair: procman sits between the tasks,
+ * tee()s the traffic into the tap pipe and splice()s it on, so that it is
+ * never copied to user space. */
+typedef struct _Relay Relay;
+struct _Relay
+{
+  Watch          in_watch;              // read end, from the writing task
+  Watch          out_watch;             // write end, to the reading task
+  int            blocked;               // 1 while waiting for out to drain
+  int            in_hup;                // 1 once the writer is gone, in is unwatched
+  int            tap[2];                // pipe the traffic is teed into
+  int            tap_fd;                // file the tap pipe is drained into
+  int            null_fd;               // where the tap overflow goes
+  size_t         pending;               // bytes teed but not spliced on yet
+  unsigned long long dropped;           // tap bytes the file did not take
+  Task          *task;                  // the writing task
+  Relay         *next;                  // next closed relay to be freed
+};
+
+typedef struct _Log Log;
+
+/* a chunk of log lines, formatted by the event loop and queued for the
+ * writer thread. */
+typedef struct _LogChunk LogChunk;
+struct _LogChunk
 {
-  Task          *next;                  // pointer to the next task
+  LogChunk      *next;
+  Log           *log;
+  size_t         used;
+  char           data[LOG_CHUNK];
+};
+
+/* a log file. only the writer thread touches the file itself, so that
+ * the event loop never blocks on it. */
+struct _Log
+{
+  const char    *path;
+  LogChunk      *chunk;                 // chunk being filled by the event loop
+  Log           *dirty_next;            // next log with lines to hand over
+  int            dirty;
+  int            fd;                    // writer thread only, -1 until opened
+  int            broken;                // writer thread only, 1 if it failed
+  off_t          size;                  // writer thread only
+};
+
+/* a histogram of durations in microseconds, with fixed buckets. */
+typedef struct _Histogram Histogram;
+struct _Histogram
+{
+  unsigned long long buckets[HISTOGRAM_BUCKETS];
+  unsigned long long count;
+  unsigned long long sum;
+};
+
+/* a thread which spawns the tasks of a shard of the pool, with -j, and
+ * reaps them by the pidfds in its own epoll. the event loop still decides
+ * what is spawned, and applies what the shards report. */
+typedef struct _Shard Shard;
+struct _Shard
+{
+  pthread_t      thread;
+  int            epfd;
+  Watch          wake_watch;            // eventfd the event loop queues tasks by
+  pthread_mutex_t lock;
+  Task          *queue;                 // tasks to spawn, under lock
+  Task          *queue_tail;
+};
+
+/* a spawn or an exit in a shard, for the event loop to apply. */
+typedef struct _ShardEvent ShardEvent;
+struct _ShardEvent
+{
+  ShardEvent    *next;
+  Task          *task;
+  int            exited;                // 1 for an exit, 0 for a spawn
+  pid_t          pid;                   // of a spawn, 0 if it failed
+  int            ready_fd;              // readiness pipe of a spawn, or -1
+  int            status;                // wait status of an exit
+  int            pidfd;                 // of an exit, still to be reaped
+  struct rusage  ru;                    // resources used by an exited run
+};
+
+/* a connection reading the metrics. they are formatted a slice of tasks
+ * at a time, as the socket drains, so that a scrape of many tasks never
+ * holds up the event loop. */
+typedef struct _Client Client;
+struct _Client
+{
+  Watch          watch;
+  unsigned int   family;                // metric being formatted
+  TaskChunk     *chunk;                 // next task to format
+  unsigned int   index;
+  size_t         len;                   // bytes formatted into buf
+  size_t         sent;                  // bytes of buf written
+  int            done;                  // 1 once all are sent, until the peer closes
+  Client        *next;                  // next closed client to be freed
+  char           buf[METRICS_BUF];
+};
 
+struct _Task
+{
+  /* hot fields, touched by every scan of the task pool */
   volatile pid_t pid;                   // pid of the task
+  Action         action;                // action of the task (once or respawn)
+  TaskState      state;                 // state of the task
   int            piped;                 // 1 if it's piped 0 if it's not
-  int            pipe_a[2];             // pipe file descriptor A
-  int            pipe_b[2];             // pipe file descriptor B
+  int            staged;                // 1 while its startup stage waits for it
+  unsigned int   order;                 // [new] order of the task
+
+  Task          *next;                  // pointer to the next task, in order
+  Task          *id_next;               // next task in the same id hash bucket
+  Task          *pid_next;              // next task in the same pid hash bucket
+
+  Task          *pipe_peer;             // task which is piped with this one
+  int            pipes_open;            // 1 once the pipes of the pair exist
+  Task          *pipe_from;             // previous stage of a pipeline
+  Task          *pipe_to;               // next stage of a pipeline
+  int            stdin_open;            // 1 once the pipe from pipe_from exists
+  unsigned long long pipe_size;         // buffer size of the pipes it writes to
+  int            packet;                // 1 if the pipes it writes to are O_DIRECT
+
+  /* output capture */
+  Watch          log_watch;             // read end of the capture pipe
+  int            log_fd;                // write end until it is spawned, or -1
+  Log           *log;                   // log its output goes to
+  char          *log_line;              // line read so far
+  unsigned int   log_line_len;
+  int            log_paused;            // 1 while the writer catches up
+  Task          *log_paused_next;
+  int            stdin_fd;              // pipe end to become stdin, or -1
+  int            stdout_fd;             // pipe end to become stdout, or -1
+  const char    *tap;                   // file the pair's traffic is teed into
+  unsigned int   index;                 // position of the task in the pool
+  TaskChunk     *chunk;                 // chunk the task lives in
+  Watch          ready_watch;           // readiness pipe while starting
+  Watch          exit_watch;            // pidfd of its process while it runs
+  unsigned int   line_nr;               // line of the task in the config
+
+  /* dependencies */
+  const char    *after;                 // ids of 'after=' tasks joined by '+'
+  const char    *requires;              // ids of 'requires=' tasks joined by '+'
+  Dependent     *dependents;            // tasks which depend on this one
+  unsigned int   n_dependents;
+  unsigned int   n_deps;                // number of tasks this one depends on
+  unsigned int   waiting;               // dependencies which have not started yet
+  int            dep_failed;            // 1 if a required task failed to start
+  int            started;               // 1 once its first start has settled
+  Task          *queue_next;            // next task in the start queue
+
+  /* respawn throttling */
+  unsigned int   max_restarts;          // restarts allowed in a window, 0 for no limit
+  unsigned int   window;                // restart window in ms
+  unsigned int   backoff;               // first backoff delay in ms
+  unsigned int   backoff_max;           // longest backoff delay in ms
+  unsigned int   restarts;              // restarts in the current window
+  long long      window_start;          // start of the current window in ms
+  long long      restart_at;            // due time of a delayed respawn in ms
+  unsigned int   heap_index;            // position in the restart timer heap
+
+  /* shutdown */
+  unsigned int   stop_timeout;          // time it gets to exit once signalled, in ms
+  long long      stop_at;               // when it was signalled to stop in ms, or 0
+  int            stop_waited;           // 1 while its stop stage waits for it
+  int            killed;                // 1 once it has been sent SIGKILL
+  Task          *stop_next;             // next task stopped by the reload
+
+  /* socket activation */
+  const char    *listen;                // address it is activated by, or NULL
+  unsigned int   idle_timeout;          // stopped once idle that long in ms, 0 for never
+  Watch          listen_watch;          // its listening socket, -1 until opened
+  int            activated;             // 1 once a connection is to spawn it
+  long long      idle_cpu;              // cpu ticks at the last idle check, or -1
+  long long      active_at;             // when it was last seen busy, in ms
+
+  /* resource accounting */
+  unsigned int   spawns;                // times it has been spawned
+  int            status;                // wait status of its last exit, -1 for none
+  long long      cpu_usec;              // user and system time of every run
+  long           max_rss;               // largest resident set of a run, in KB
+  unsigned long long memory_max;        // memory.max of its cgroup, 0 for none
+  unsigned int   cpu_max;               // cpu.max of its cgroup in percent, 0 for none
+  int            cgroup_made;           // 1 once its cgroup exists
+  int            cgroup_fd;             // its cgroup while spawning, or -1
+  long long      started_at;            // when its current run was spawned, in ms
+  long long      exited_at;             // when its last run was reaped, in us
+
+  /* sharded spawning, with -j */
+  Task          *spawn_next;            // next task in the spawn queue of its shard
+  int            spawning;              // 1 while a shard spawns it
+
+  /* config reloads */
+  const char    *line;                  // line defining the task, in the string pool
+  unsigned int   line_hash;
+  unsigned int   generation;            // last reload which found its line
+  unsigned int   reload;                // RELOAD_* flags during a reload
+  Task          *reload_next;           // next task touched by the reload
+  int            removed;               // 1 once its line is gone, the task is dead
+  Task          *free_next;             // next free slot, once it is reclaimed
+  int            start_ok;              // 1 if its first start succeeded
 
   char           id[ID_MAX + 1];        // identifier of the task
-  unsigned int   order;                 // [new] order of the task
   char           pipe_id[ID_MAX + 1];   // id of a task which is piped with
-  Action         action;                // action of the task (once or respawn)
-  char           command[COMMAND_LEN];  // command of the task
+  char           pipe_from_id[ID_MAX + 1]; // id of the previous stage of a pipeline
+  const char    *command;               // command of the task, in the string pool
+  char         **argv;                  // parsed command, in the string pool
 };
 
-static Task *tasks;                     // list of tasks
+/* tasks are allocated from fixed size chunks, so that they are contiguous
+ * in memory and never move once allocated. */
+struct _TaskChunk
+{
+  TaskChunk     *next;
+  unsigned int   used;
+  pid_t          pids[TASK_CHUNK_SIZE]; // live pid of each task, or 0, packed
+  Task           tasks[TASK_CHUNK_SIZE];
+};
+
+/* cold strings (commands and their argv) are packed into a separate pool. */
+typedef struct _StringChunk StringChunk;
+struct _StringChunk
+{
+  StringChunk   *next;
+  size_t         used;
+  size_t         size;
+  char           data[] __attribute__ ((aligned (sizeof (void *))));
+};
+
+/* a config file mapped into memory, read a line at a time. */
+typedef struct _ConfigFile ConfigFile;
+struct _ConfigFile
+{
+  const char    *data;
+  size_t         size;
+  size_t         pos;                   // start of the next line
+  int            mapped;                // 1 if data is mapped, 0 if read
+  int            line_nr;
+  int            indent;                // white spaces stripped off the line
+  char          *line;                  // the current line, stripped
+  size_t         line_size;
+};
+
+#define TASK_OF_WATCH(watch, member)                                    \
+  ((Task *) ((char *) (watch) - offsetof (Task, member)))
+
+#define FOR_EACH_TASK(chunk, task)                                      \
+  for (chunk = task_chunks; chunk != NULL; chunk = chunk->next)         \
+    for (task = chunk->tasks; task < chunk->tasks + chunk->used; task++)
+
+/* walk the tasks with a live pid. the scan strides the packed pids of a
+ * chunk, and only touches the tasks it stops at. */
+#define FOR_EACH_LIVE_TASK(chunk, i, task)                              \
+  for (chunk = task_chunks; chunk != NULL; chunk = chunk->next)         \
+    for (i = 0; i < chunk->used; i++)                                   \
+      if ((task = &chunk->tasks[i]), chunk->pids[i] > 0)
+
+static Task *tasks;                     // list of tasks, sorted by order
+static unsigned int n_tasks;            // number of tasks in the pool
+static unsigned int n_running;          // number of tasks with a live pid
+
+static TaskChunk   *task_chunks;        // pool of tasks
+static TaskChunk   *task_chunk_tail;
+static StringChunk *string_chunks;      // pool of strings
+static size_t       pool_used;          // bytes taken from the string pool
+static size_t       pool_kept;          // of which live after the last compaction
+static Task        *free_tasks;         // reclaimed slots of removed tasks
+
+static Task       **id_table;           // id -> task hash index
+static unsigned int id_table_size;
+static unsigned int id_table_count;
+static Task       **pid_table;          // pid -> task hash index
+static unsigned int pid_table_size;
+static unsigned int pid_table_count;
 
 static sigset_t mask;                   // [new] mask for signalfd()
 static int sfd;                         // [new] signal file descriptor from signalfd()
+static int epfd;                        // epoll instance of the event loop
+static LoopBackend loop_backend = LOOP_EPOLL;
+static Uring ring;                      // with -e uring
+static Watch signal_watch;
 static volatile int running;
+static int reap_pending;                // reaping stopped early, resume it
+static int use_pidfd;                   // children are reaped by their pidfd, not SIGCHLD
+static SpawnBackend spawn_backend = SPAWN_FORK;
+
+static int tfd;                         // timer fd for delayed respawns
+static Watch timer_watch;
+static Task *stage_next;                // first task of the next startup stage
+static unsigned int stage_pending;      // tasks of the current stage not ready yet
+static Task *start_queue;               // tasks whose dependencies have settled
+static Task *start_queue_tail;
+static unsigned int n_unstarted;        // tasks whose first start has not settled
+static long long startup_begin;         // when spawn_tasks() was called, in ms
+
+static int shutdown_signo;              // signal which began the shutdown, or 0
+static long long shutdown_begin;        // in ms
+static unsigned int shutdown_timeout = SHUTDOWN_TIMEOUT;  // with -k
+static Task **stop_tasks;               // running tasks, by descending order
+static unsigned int n_stop_tasks;
+static unsigned int stop_stage;         // first task of the stage being stopped
+static unsigned int stop_stage_end;
+static unsigned int stop_pending;       // tasks of the stage which have not exited
+static unsigned int n_killed;
+static int stop_killing;                // every task is being killed
+static int stop_tfd = -1;               // timer fd for the stop deadlines
+static Watch stop_watch;
+static unsigned int n_listening;        // tasks waiting for a connection
+static int idle_tfd = -1;               // timer fd for the idle checks
+static Watch idle_watch;
+static int verbose;
 
+static const char *cgroup_root;         // parent of the task cgroups, with -c
+static char *cache_path;                // compiled config, with -C
+static int cgroup_root_fd = -1;
 
+static Relay *closed_relays;            // freed once no event refers to them
+
+static const char *metrics_path;        // metrics socket, with -m
+static Watch metrics_watch;
+static unsigned int n_clients;
+static Client *closed_clients;          // freed once no event refers to them
+static Histogram respawn_latency;       // from the exit of a task to its respawn
+static Histogram loop_lag;              // time to dispatch a batch of events
+static unsigned long long loop_turns;
+static long long procman_started_at;    // in ms
+
+static Shard *shards;                   // spawning threads, with -j
+static unsigned int n_shards;
+static unsigned int n_spawning;         // tasks handed to a shard, not spawned yet
+static ShardEvent *shard_events;        // reported by the shards, under shard_lock
+static ShardEvent *shard_events_tail;
+static ShardEvent *shard_free;          // events to reuse, under shard_lock
+static int shard_efd;                   // the shards wake the loop up by it
+static Watch shard_watch;
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Log *log_combined;               // log of every task, with -l
+static const char *log_dir;             // directory of the task logs, with -L
+static unsigned long long log_rotate;   // size a log is rotated at, 0 for never
+static Log *dirty_logs;                 // logs with lines to hand over
+static Task *log_paused;                // tasks whose capture waits for the writer
+static int log_efd;                     // the writer wakes the loop up by it
+static Watch log_watch;
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static LogChunk *log_queue;             // chunks to be written, oldest first
+static LogChunk *log_queue_tail;
+static LogChunk *log_free;              // written chunks, to be reused
+static unsigned int log_chunks;         // chunks being filled, queued or written
+static int log_waiting;                 // 1 if the loop waits for chunks to be freed
+static int log_stopping;
+
+static Task **timer_heap;               // delayed respawns, earliest first
+static unsigned int timer_heap_count;
+static unsigned int timer_heap_size;
+
+static const char *config_path;
+static unsigned int config_generation;  // reloads so far
+static int reload_pending;              // SIGHUP while tasks were being started
+static Task *reload_tasks;              // redefined tasks, started once the old ones exit
+static unsigned int reload_stopping;    // old processes not reaped yet
+static Task *reload_stops;              // tasks the reload is stopping, some reaped
+static Task *reload_dirty;              // tasks touched by the current reload
+static Task *reload_dirty_tail;
+static unsigned int reload_dirty_count;
+
+static const char *parse_line;          // line being parsed, for the columns of errors
+static int parse_line_nr;
+static int parse_indent;                // white spaces stripped off its start
+
+
+/* strip the white spaces around a string in place, without moving it:
+ * the end is cut short and the first other character is returned. */
 static char *
 strstrip (char *str)
 {
-  char  *start;
-  size_t len;
+  char *end;
 
-  len = strlen (str);
-  while (len--)
+  while (isspace (*str))
+    str++;
+  for (end = str + strlen (str); end > str && isspace (end[-1]); end--)
+    ;
+  *end = '\0';
+
+  return str;
+}
+
+static long long
+monotonic_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long
+monotonic_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static const long long histogram_bounds[HISTOGRAM_BUCKETS - 1] =
+{
+  100, 1000, 10000, 100000, 1000000, 10000000,
+};
+
+static void
+observe (Histogram *histogram,
+         long long  usec)
+{
+  int i;
+
+  for (i = 0; i < HISTOGRAM_BUCKETS - 1 && usec > histogram_bounds[i]; i++)
+    ;
+  histogram->buckets[i]++;
+  histogram->count++;
+  histogram->sum += usec;
+}
+
+static int
+add_watch_to (int          ep,
+              Watch       *watch,
+              int          fd,
+              unsigned int events,
+              WatchFunc    func)
+{
+  struct epoll_event ev;
+
+  watch->fd = fd;
+  watch->func = func;
+
+  memset (&ev, 0x00, sizeof (ev));
+  ev.events = events;
+  ev.data.ptr = watch;
+  if (epoll_ctl (ep, EPOLL_CTL_ADD, fd, &ev))
   {
-    if (!isspace (str[len]))
-      break;
-    str[len] = '\0';
+    MSG ("failed to watch fd %d: %s\n", fd, STRERROR);
+    return -1;
   }
 
-  for (start = str; *start && isspace (*start); start++);
-  memmove (str, start, strlen (start) + 1);
+  return 0;
+}
+
+static int
+setup_uring (unsigned int entries)
+{
+  struct io_uring_params params;
+  size_t                 sq_size;
+  size_t                 cq_size;
+  char                  *sq;
+  char                  *cq;
 
-  return str;
+  memset (&params, 0x00, sizeof (params));
+  ring.fd = syscall (SYS_io_uring_setup, entries, &params);
+  if (ring.fd < 0)
+    return -1;
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP && cq_size > sq_size)
+    sq_size = cq_size;
+
+  sq = mmap (NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ring.fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    goto failed;
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    cq = sq;
+  else
+  {
+    cq = mmap (NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ring.fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      goto failed;
+  }
+  ring.sqes = mmap (NULL, params.sq_entries * sizeof (struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring.fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED)
+    goto failed;
+
+  ring.sq_head = (unsigned int *) (sq + params.sq_off.head);
+  ring.sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+  ring.sq_mask = *(unsigned int *) (sq + params.sq_off.ring_mask);
+  ring.sq_entries = params.sq_entries;
+  ring.sq_array = (unsigned int *) (sq + params.sq_off.array);
+  ring.cq_head = (unsigned int *) (cq + params.cq_off.head);
+  ring.cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+  ring.cq_mask = *(unsigned int *) (cq + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return 0;
+
+failed:
+  close (ring.fd);                      // the mappings are not worth unmapping
+  return -1;
+}
+
+/* submit the queued requests, and wait for 'min_complete' completions. */
+static int
+enter_uring (unsigned int min_complete)
+{
+  int n;
+
+  n = syscall (SYS_io_uring_enter, ring.fd, ring.to_submit, min_complete,
+               min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (n < 0)
+    return -1;
+  ring.to_submit -= n;
+
+  return 0;
+}
+
+static void
+queue_uring (unsigned char      opcode,
+             int                fd,
+             unsigned int       events,
+             unsigned long long addr,
+             unsigned long long user_data)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int         tail;
+
+  tail = *ring.sq_tail;
+  while (tail - __atomic_load_n (ring.sq_head, __ATOMIC_ACQUIRE) == ring.sq_entries)
+    if (enter_uring (0) && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      MSG ("failed to submit to io_uring: %s\n", STRERROR);
+      return;
+    }
+
+  sqe = &ring.sqes[tail & ring.sq_mask];
+  memset (sqe, 0x00, sizeof (*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->addr = addr;
+  sqe->user_data = user_data;
+  ring.sq_array[tail & ring.sq_mask] = tail & ring.sq_mask;
+  __atomic_store_n (ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring.to_submit++;
+}
+
+static unsigned long long
+uring_poll_id (unsigned int slot)
+{
+  return (unsigned long long) ring.slots[slot].gen << 32 | slot;
+}
+
+/* poll the fd of a watch once; it is polled again once it has fired. */
+static void
+arm_uring_slot (unsigned int slot)
+{
+  Watch *watch = ring.slots[slot].watch;
+
+  queue_uring (IORING_OP_POLL_ADD, watch->fd, watch->events, 0, uring_poll_id (slot));
+  ring.slots[slot].armed = 1;
+}
+
+static void
+disarm_uring_slot (unsigned int slot)
+{
+  if (!ring.slots[slot].armed)
+    return;
+  queue_uring (IORING_OP_POLL_REMOVE, -1, 0, uring_poll_id (slot), URING_NO_WATCH);
+  ring.slots[slot].gen++;
+  ring.slots[slot].armed = 0;
+}
+
+static int
+add_uring_watch (Watch       *watch,
+                 unsigned int events)
+{
+  unsigned int slot;
+
+  if (!ring.free_slot)
+  {
+    unsigned int size = ring.n_slots ? ring.n_slots * 2 : HASH_SIZE_MIN;
+    UringSlot   *slots;
+
+    slots = realloc (ring.slots, size * sizeof (UringSlot));
+    if (!slots)
+    {
+      MSG ("failed to watch fd %d: %s\n", watch->fd, STRERROR);
+      return -1;
+    }
+    memset (slots + ring.n_slots, 0x00, (size - ring.n_slots) * sizeof (UringSlot));
+    for (slot = ring.n_slots; slot < size; slot++)
+      slots[slot].next_free = slot + 2 < size + 1 ? slot + 2 : 0;
+    ring.free_slot = ring.n_slots + 1;
+    ring.slots = slots;
+    ring.n_slots = size;
+  }
+
+  slot = ring.free_slot - 1;
+  ring.free_slot = ring.slots[slot].next_free;
+  ring.slots[slot].watch = watch;
+  watch->slot = slot + 1;
+  watch->events = events;
+  if (events)
+    arm_uring_slot (slot);
+
+  return 0;
+}
+
+static void
+remove_uring_watch (Watch *watch)
+{
+  unsigned int slot = watch->slot - 1;
+
+  disarm_uring_slot (slot);
+  ring.slots[slot].watch = NULL;
+  ring.slots[slot].gen++;
+  ring.slots[slot].next_free = ring.free_slot;
+  ring.free_slot = slot + 1;
+  watch->slot = 0;
+}
+
+/* submit what has changed since the last turn, and wait for completions
+ * as epoll_wait() does. */
+static int
+wait_uring (struct epoll_event *events,
+            int                 max,
+            int                 timeout)
+{
+  unsigned int head;
+  unsigned int tail;
+  unsigned int i;
+  int          n;
+
+  for (i = 0; i < ring.n_fired; i++)
+  {
+    UringSlot *slot = &ring.slots[ring.fired[i]];
+
+    if (slot->watch && !slot->armed && slot->watch->events)
+      arm_uring_slot (ring.fired[i]);
+  }
+  ring.n_fired = 0;
+
+  head = *ring.cq_head;
+  if (head == __atomic_load_n (ring.cq_tail, __ATOMIC_ACQUIRE))
+  {
+    if (enter_uring (timeout ? 1 : 0))
+      return -1;
+  }
+  else if (ring.to_submit && enter_uring (0) && errno != EINTR)
+    return -1;
+
+  n = 0;
+  tail = __atomic_load_n (ring.cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail && n < max; head++)
+  {
+    struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+    unsigned int         slot = cqe->user_data & 0xffffffff;
+
+    if (cqe->user_data == URING_NO_WATCH || slot >= ring.n_slots ||
+        cqe->user_data != uring_poll_id (slot) || !ring.slots[slot].watch)
+      continue;                         // a removed poll, or its removal
+
+    ring.slots[slot].armed = 0;
+    ring.fired[ring.n_fired++] = slot;
+    events[n].events = cqe->res < 0 ? EPOLLERR : cqe->res;
+    events[n].data.ptr = ring.slots[slot].watch;
+    n++;
+  }
+  __atomic_store_n (ring.cq_head, head, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+static int
+wait_events (struct epoll_event *events,
+             int                 max,
+             int                 timeout)
+{
+  if (loop_backend == LOOP_URING)
+    return wait_uring (events, max, timeout);
+
+  return epoll_wait (epfd, events, max, timeout);
+}
+
+static int
+add_watch (Watch       *watch,
+           int          fd,
+           unsigned int events,
+           WatchFunc    func)
+{
+  if (loop_backend != LOOP_URING)
+    return add_watch_to (epfd, watch, fd, events, func);
+
+  watch->fd = fd;
+  watch->func = func;
+
+  return add_uring_watch (watch, events);
+}
+
+/* change the events a watch waits for. */
+static void
+modify_watch (Watch       *watch,
+              unsigned int events)
+{
+  struct epoll_event ev;
+
+  if (loop_backend == LOOP_URING)
+  {
+    unsigned int slot = watch->slot - 1;
+
+    if (ring.slots[slot].armed && watch->events == events)
+      return;
+    disarm_uring_slot (slot);
+    watch->events = events;
+    if (events)
+      arm_uring_slot (slot);
+    return;
+  }
+
+  memset (&ev, 0x00, sizeof (ev));
+  ev.events = events;
+  ev.data.ptr = watch;
+  if (epoll_ctl (epfd, EPOLL_CTL_MOD, watch->fd, &ev))
+    MSG ("failed to rewatch fd %d: %s\n", watch->fd, STRERROR);
+}
+
+static void
+remove_watch (Watch *watch)
+{
+  if (loop_backend == LOOP_URING)
+    remove_uring_watch (watch);
+  else if (epoll_ctl (epfd, EPOLL_CTL_DEL, watch->fd, NULL))
+    MSG ("failed to unwatch fd %d: %s\n", watch->fd, STRERROR);
 }
 
 static int
@@ -110,403 +938,5028 @@ check_valid_order (const char *str)
   return 0;
 }
 
-static Task *
-lookup_task (const char *id)
+static unsigned int
+hash_id (const char *id)
 {
-  Task *task;
+  unsigned int h = 2166136261u;          // FNV-1a
 
-  for (task = tasks; task != NULL; task = task->next)
-    if (!strcmp (task->id, id))
-      return task;
+  while (*id)
+    h = (h ^ (unsigned char) *id++) * 16777619u;
 
-  return NULL;
+  return h;
 }
 
-static Task *
-lookup_task_by_pid (pid_t pid)
+static unsigned int
+hash_pid (pid_t pid)
 {
-  Task *task;
+  return (unsigned int) pid * 2654435761u;
+}
 
-  for (task = tasks; task != NULL; task = task->next)
-    if (task->pid == pid)
-      return task;
+/* grow a hash table so it keeps at most one task per bucket on average.
+ * chains are relinked through the 'next' field at offset 'link'. */
+static int
+resize_table (Task ***table, unsigned int *size, unsigned int count, size_t link, int by_pid)
+{
+  Task       **buckets;
+  unsigned int new_size;
+  unsigned int i;
 
-  return NULL;
+  new_size = *size ? *size : HASH_SIZE_MIN;
+  while (new_size < count)
+    new_size <<= 1;
+  if (new_size == *size)
+    return 0;
+
+  buckets = calloc (new_size, sizeof (Task *));
+  if (!buckets)
+  {
+    MSG ("failed to allocate a hash table: %s\n", STRERROR);
+    return -1;
+  }
+
+  for (i = 0; i < *size; i++)
+  {
+    Task *task;
+    Task *next;
+
+    for (task = (*table)[i]; task != NULL; task = next)
+    {
+      Task       **slot;
+      unsigned int h;
+
+      next = *(Task **) ((char *) task + link);
+      h = by_pid ? hash_pid (task->pid) : hash_id (task->id);
+      slot = &buckets[h & (new_size - 1)];
+      *(Task **) ((char *) task + link) = *slot;
+      *slot = task;
+    }
+  }
+
+  free (*table);
+  *table = buckets;
+  *size = new_size;
+
+  return 0;
 }
 
 static void
-append_task (Task *task)
+index_task_id (Task *task)
 {
-  Task *new_task;
+  Task **slot;
 
-  new_task = malloc (sizeof (Task));
+  if (resize_table (&id_table, &id_table_size, id_table_count + 1,
+                    offsetof (Task, id_next), 0))
+    return;
+
+  slot = &id_table[hash_id (task->id) & (id_table_size - 1)];
+  task->id_next = *slot;
+  *slot = task;
+  id_table_count++;
+}
+
+static void
+unindex_task_id (Task *task)
+{
+  Task **slot;
+
+  for (slot = &id_table[hash_id (task->id) & (id_table_size - 1)];
+       *slot != NULL; slot = &(*slot)->id_next)
+    if (*slot == task)
+    {
+      *slot = task->id_next;
+      task->id_next = NULL;
+      id_table_count--;
+      break;
+    }
+}
+
+/* update the pid of a task, keeping the pid index and the number of
+ * running tasks consistent. */
+static void
+set_task_pid (Task *task, pid_t pid)
+{
+  Task **slot;
+
+  if (task->pid > 0)
+  {
+    n_running--;
+    for (slot = &pid_table[hash_pid (task->pid) & (pid_table_size - 1)];
+         *slot != NULL; slot = &(*slot)->pid_next)
+      if (*slot == task)
+      {
+        *slot = task->pid_next;
+        pid_table_count--;
+        break;
+      }
+  }
+
+  task->pid = pid;
+  task->chunk->pids[task - task->chunk->tasks] = pid > 0 ? pid : 0;
+  task->pid_next = NULL;
+  if (pid > 0)
+    task->state = TASK_RUNNING;
+  else if (task->state != TASK_FAILED)  // redefined while its old run exits
+    task->state = TASK_IDLE;
+  if (pid <= 0)
+    return;
+  n_running++;
+
+  if (resize_table (&pid_table, &pid_table_size, pid_table_count + 1,
+                    offsetof (Task, pid_next), 1))
+    return;
+
+  slot = &pid_table[hash_pid (pid) & (pid_table_size - 1)];
+  task->pid_next = *slot;
+  *slot = task;
+  pid_table_count++;
+}
+
+static Task *
+lookup_task (const char *id)
+{
+  Task *task;
+
+  if (!id_table_size)
+    return NULL;
+
+  for (task = id_table[hash_id (id) & (id_table_size - 1)]; task != NULL; task = task->id_next)
+    if (!strcmp (task->id, id))
+      return task;
+
+  return NULL;
+}
+
+static Task *
+lookup_task_by_pid (pid_t pid)
+{
+  Task *task;
+
+  if (!pid_table_size)
+    return NULL;
+
+  for (task = pid_table[hash_pid (pid) & (pid_table_size - 1)]; task != NULL; task = task->pid_next)
+    if (task->pid == pid)
+      return task;
+
+  return NULL;
+}
+
+static void *
+pool_alloc (size_t size,
+            size_t align)
+{
+  StringChunk *chunk;
+  size_t       offset;
+
+  chunk = string_chunks;
+  offset = chunk ? (chunk->used + align - 1) & ~(align - 1) : 0;
+  if (!chunk || offset > chunk->size || chunk->size - offset < size)
+  {
+    size_t len;
+
+    len = size > STRING_CHUNK_SIZE ? size : STRING_CHUNK_SIZE;
+    chunk = malloc (sizeof (StringChunk) + len);
+    if (!chunk)
+      return NULL;
+    chunk->next = string_chunks;
+    chunk->used = 0;
+    chunk->size = len;
+    string_chunks = chunk;
+    offset = 0;
+  }
+
+  chunk->used = offset + size;
+  pool_used += size;
+
+  return chunk->data + offset;
+}
+
+static const char *
+pool_strdup (const char *str)
+{
+  char  *dup;
+  size_t len;
+
+  len = strlen (str) + 1;
+  dup = pool_alloc (len, 1);
+  if (dup)
+    memcpy (dup, str, len);
+
+  return dup;
+}
+
+static Task *
+alloc_task (TaskChunk   **chunk_p,
+            unsigned int *index)
+{
+  TaskChunk *chunk;
+  Task      *task;
+
+  task = free_tasks;
+  if (task)
+  {
+    free_tasks = task->free_next;
+    *chunk_p = task->chunk;
+    *index = task->index;
+    return task;
+  }
+
+  chunk = task_chunk_tail;
+  if (!chunk || chunk->used == TASK_CHUNK_SIZE)
+  {
+    chunk = malloc (sizeof (TaskChunk));
+    if (!chunk)
+      return NULL;
+    chunk->next = NULL;
+    chunk->used = 0;
+    if (task_chunk_tail)
+      task_chunk_tail->next = chunk;
+    else
+      task_chunks = chunk;
+    task_chunk_tail = chunk;
+  }
+
+  *chunk_p = chunk;
+  *index = n_tasks++;
+  chunk->pids[chunk->used] = 0;
+  return &chunk->tasks[chunk->used++];
+}
+
+static Task *
+append_task (Task *task)
+{
+  Task        *new_task;
+  TaskChunk   *chunk;
+  unsigned int index;
+
+  new_task = alloc_task (&chunk, &index);
   if (!new_task)
   {
     MSG ("failed to allocate a task: %s\n", STRERROR);
-    return;
+    return NULL;
+  }
+
+  *new_task = *task;
+  new_task->next = NULL;
+  new_task->pid_next = NULL;
+  new_task->index = index;
+  new_task->chunk = chunk;
+  new_task->stdin_fd = -1;
+  new_task->stdout_fd = -1;
+  new_task->log_watch.fd = -1;
+  new_task->exit_watch.fd = -1;
+  new_task->listen_watch.fd = -1;
+  new_task->log_fd = -1;
+  new_task->status = -1;
+  new_task->cgroup_fd = -1;
+  new_task->generation = config_generation;
+  index_task_id (new_task);
+
+  return new_task;
+}
+
+static int
+compare_task_order (const void *a,
+                    const void *b)
+{
+  const Task *ta = *(const Task **) a;
+  const Task *tb = *(const Task **) b;
+
+  if (ta->order != tb->order)
+    return ta->order < tb->order ? -1 : 1;
+
+  return ta->index < tb->index ? -1 : ta->index > tb->index;
+}
+
+/* [new] link tasks by the order, keeping the config order for ties. */
+static Task *
+link_sorted_tasks (Task       **sorted,
+                   unsigned int n)
+{
+  unsigned int i;
+
+  if (!n)
+    return NULL;
+
+  qsort (sorted, n, sizeof (Task *), compare_task_order);
+  sorted[n - 1]->next = NULL;
+  for (i = n - 1; i > 0; i--)
+    sorted[i - 1]->next = sorted[i];
+
+  return sorted[0];
+}
+
+/* the same for the whole pool, by a counting sort of the orders, which
+ * reads the pool in place rather than all over it. */
+static int
+sort_tasks (void)
+{
+  TaskChunk    *chunk;
+  Task         *task;
+  Task        **sorted;
+  unsigned int *starts;
+  unsigned int  i;
+
+  tasks = NULL;
+  if (!n_tasks)
+    return 0;
+
+  sorted = malloc (n_tasks * sizeof (Task *));
+  starts = calloc (ORDER_LIMIT + 1, sizeof (unsigned int));
+  if (!sorted || !starts)
+  {
+    MSG ("failed to sort tasks: %s\n", STRERROR);
+    free (sorted);
+    free (starts);
+    return -1;
+  }
+
+  FOR_EACH_TASK (chunk, task)
+    starts[task->order + 1]++;
+  for (i = 1; i <= ORDER_LIMIT; i++)
+    starts[i] += starts[i - 1];
+  FOR_EACH_TASK (chunk, task)
+    sorted[starts[task->order]++] = task;
+
+  sorted[n_tasks - 1]->next = NULL;
+  for (i = n_tasks - 1; i > 0; i--)
+    sorted[i - 1]->next = sorted[i];
+  tasks = sorted[0];
+
+  free (starts);
+  free (sorted);
+
+  return 0;
+}
+
+/* parse a duration: a number with an optional 'ms', 's' or 'm' suffix,
+ * seconds by default. */
+static int
+parse_duration (const char   *str,
+                unsigned int *ms)
+{
+  char         *end;
+  unsigned long value;
+  unsigned long unit;
+
+  if (!isdigit (str[0]))
+    return -1;
+
+  errno = 0;
+  value = strtoul (str, &end, 10);
+  if (errno)
+    return -1;
+
+  if (!strcmp (end, "ms"))
+    unit = 1;
+  else if (!strcmp (end, "s") || end[0] == '\0')
+    unit = 1000;
+  else if (!strcmp (end, "m"))
+    unit = 60 * 1000;
+  else
+    return -1;
+
+  if (value > 0x7fffffff / unit)
+    return -1;
+  *ms = value * unit;
+
+  return 0;
+}
+
+/* parse a size in bytes: a number with an optional 'K', 'M' or 'G'
+ * suffix. */
+static int
+parse_size (const char         *str,
+            unsigned long long *size)
+{
+  char              *end;
+  unsigned long long value;
+  int                shift;
+
+  if (!isdigit (str[0]))
+    return -1;
+
+  errno = 0;
+  value = strtoull (str, &end, 10);
+  if (errno)
+    return -1;
+
+  if (!strcmp (end, "G"))
+    shift = 30;
+  else if (!strcmp (end, "M"))
+    shift = 20;
+  else if (!strcmp (end, "K"))
+    shift = 10;
+  else if (end[0] == '\0')
+    shift = 0;
+  else
+    return -1;
+
+  if (value > (~0ULL >> shift))
+    return -1;
+  *size = value << shift;
+
+  return 0;
+}
+
+/* parse a share of CPU time, in percent of one CPU. */
+static int
+parse_percent (const char   *str,
+               unsigned int *percent)
+{
+  char         *end;
+  unsigned long value;
+
+  if (!isdigit (str[0]))
+    return -1;
+
+  errno = 0;
+  value = strtoul (str, &end, 10);
+  if (errno || strcmp (end, "%") || value == 0 || value > 100000)
+    return -1;
+  *percent = value;
+
+  return 0;
+}
+
+static int
+parse_number (const char   *str,
+              unsigned int *number)
+{
+  char         *end;
+  unsigned long value;
+
+  if (!isdigit (str[0]))
+    return -1;
+
+  errno = 0;
+  value = strtoul (str, &end, 10);
+  if (errno || end[0] != '\0' || value > 0x7fffffff)
+    return -1;
+  *number = value;
+
+  return 0;
+}
+
+static int
+parse_task_id (const char *str,
+               char        id[ID_MAX + 1])
+{
+  if (check_valid_id (str))
+    return -1;
+  strcpy (id, str);
+
+  return 0;
+}
+
+/* parse ids joined by '+' into the string pool, appending them to the
+ * ones of a previous option if any. */
+static int
+parse_task_ids (const char  *str,
+                const char **ids)
+{
+  char       *buf;
+  char       *id;
+  char       *p;
+  size_t      len;
+
+  len = strlen (str) + 1;
+  if (*ids)
+    len += strlen (*ids) + 1;
+  buf = pool_alloc (len, 1);
+  if (!buf)
+    return -1;
+  if (*ids)
+    snprintf (buf, len, "%s+%s", *ids, str);
+  else
+    strcpy (buf, str);
+
+  /* validate a copy, as strsep() splits it */
+  p = strdupa (buf);
+  while ((id = strsep (&p, "+")) != NULL)
+    if (check_valid_id (strstrip (id)))
+      return -1;
+
+  /* drop white spaces around ids */
+  for (id = p = buf; *p; p++)
+    if (!isspace (*p))
+      *id++ = *p;
+  *id = '\0';
+
+  *ids = buf;
+
+  return 0;
+}
+
+/* report an invalid part of the line being parsed, which is ignored. */
+static void
+line_error (const char *at,
+            const char *format,
+            ...)
+{
+  va_list args;
+
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
+  MSG (" in line %d column %d, ignored\n", parse_line_nr,
+       (int) (at - parse_line) + parse_indent + 1);
+}
+
+/* parse the comma separated 'key=value' options following the action. */
+static int
+parse_task_options (Task *task,
+                    char *options)
+{
+  char *option;
+
+  while ((option = strsep (&options, ",")) != NULL)
+  {
+    char *value;
+    int   err;
+
+    option = strstrip (option);
+    value = strchr (option, '=');
+    if (value)
+    {
+      *value++ = '\0';
+      option = strstrip (option);
+      value = strstrip (value);
+    }
+
+    if (!value)
+    {
+      err = 0;
+      if (!strcmp (option, "packet"))   // flags take no value
+        task->packet = 1;
+      else
+        err = -1;
+    }
+    else if (!strcmp (option, "max-restarts"))
+      err = parse_number (value, &task->max_restarts);
+    else if (!strcmp (option, "window"))
+      err = parse_duration (value, &task->window);
+    else if (!strcmp (option, "backoff"))
+      err = parse_duration (value, &task->backoff);
+    else if (!strcmp (option, "backoff-max"))
+      err = parse_duration (value, &task->backoff_max);
+    else if (!strcmp (option, "stop-timeout"))
+      err = parse_duration (value, &task->stop_timeout);
+    else if (!strcmp (option, "after"))
+      err = parse_task_ids (value, &task->after);
+    else if (!strcmp (option, "requires"))
+      err = parse_task_ids (value, &task->requires);
+    else if (!strcmp (option, "tap"))
+      err = value[0] == '\0' || !(task->tap = pool_strdup (value));
+    else if (!strcmp (option, "listen"))
+      err = value[0] == '\0' || !(task->listen = pool_strdup (value));
+    else if (!strcmp (option, "idle-timeout"))
+      err = parse_duration (value, &task->idle_timeout);
+    else if (!strcmp (option, "pipe-from"))
+      err = parse_task_id (value, task->pipe_from_id);
+    else if (!strcmp (option, "pipe-size"))
+      err = parse_size (value, &task->pipe_size) || task->pipe_size > 0x7fffffff;
+    else if (!strcmp (option, "memory-max"))
+      err = parse_size (value, &task->memory_max);
+    else if (!strcmp (option, "cpu-max"))
+      err = parse_percent (value, &task->cpu_max);
+    else
+      err = -1;
+
+    if (err)
+    {
+      line_error (option, "invalid option '%s'", option);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* split a command into arguments: white spaces separate them, "..." and
+ * '...' quote them, and a backslash escapes the next character (except
+ * in '...'). argv and the strings are written only when they are given,
+ * so the same walk sizes and then fills the vector. */
+static int
+scan_command (const char *p,
+              char      **argv,
+              char       *buf,
+              size_t     *n_args,
+              size_t     *n_bytes)
+{
+  size_t args;
+  size_t bytes;
+
+  for (args = 0, bytes = 0; ; args++, bytes++)
+  {
+    char quote;
+
+    while (isspace (*p))
+      p++;
+    if (*p == '\0')
+      break;
+
+    if (argv)
+      argv[args] = buf + bytes;
+    for (quote = 0; *p; p++)
+    {
+      if (quote)
+      {
+        if (*p == quote)
+        {
+          quote = 0;
+          continue;
+        }
+        if (*p == '\\' && quote == '"' && p[1])
+          p++;
+      }
+      else
+      {
+        if (isspace (*p))
+          break;
+        if (*p == '"' || *p == '\'')
+        {
+          quote = *p;
+          continue;
+        }
+        if (*p == '\\' && p[1])
+          p++;
+      }
+
+      if (buf)
+        buf[bytes] = *p;
+      bytes++;
+    }
+    if (quote)
+      return -1;
+
+    if (buf)
+      buf[bytes] = '\0';
+  }
+
+  if (argv)
+    argv[args] = NULL;
+  *n_args = args;
+  *n_bytes = bytes;
+
+  return 0;
+}
+
+/* parse a command once at load, into a single allocation in the string
+ * pool holding the vector followed by its strings. */
+static char **
+parse_command_argv (const char *str)
+{
+  char **argv;
+  size_t n_args;
+  size_t n_bytes;
+
+  if (scan_command (str, NULL, NULL, &n_args, &n_bytes) || n_args == 0)
+    return NULL;
+
+  argv = pool_alloc ((n_args + 1) * sizeof (char *) + n_bytes, sizeof (char *));
+  if (!argv)
+  {
+    MSG ("failed to allocate a command vector: %s\n", STRERROR);
+    return NULL;
+  }
+  scan_command (str, argv, (char *) (argv + n_args + 1), &n_args, &n_bytes);
+
+  if (0)
+  {
+    int n;
+
+    MSG ("command:%s\n", str);
+    for (n = 0; argv[n] != NULL; n++)
+      MSG ("  argv[%d]:%s\n", n, argv[n]);
+  }
+
+  return argv;
+}
+
+/* get the next id of a '+' joined list. */
+static int
+next_task_id (const char **ids,
+              char         id[ID_MAX + 1])
+{
+  size_t len;
+
+  if (!*ids || !**ids)
+    return 0;
+
+  len = strcspn (*ids, "+");
+  memcpy (id, *ids, len);
+  id[len] = '\0';
+  *ids += len;
+  if (**ids == '+')
+    (*ids)++;
+
+  return 1;
+}
+
+/* link every task of a list to the tasks which depend on it, and check
+ * that the dependencies form a DAG. tasks with unknown dependencies, or
+ * which take part in or depend on a cycle, will not be started. for a
+ * 'partial' list, from a reload, the tasks out of it have settled long
+ * ago and only the failed ones still matter. */
+static int
+resolve_dependencies (Task *list,
+                      int   partial)
+{
+  Task       *task;
+  Task       *queue;
+  Task       *tail;
+  const char *ids;
+  char        id[ID_MAX + 1];
+  int         required;
+  int         fill;
+
+  for (fill = 0; fill < 2; fill++)
+  {
+    for (task = list; task != NULL; task = task->next)
+      for (required = 0; required < 2; required++)
+        for (ids = required ? task->requires : task->after; next_task_id (&ids, id); )
+        {
+          Task *dep = lookup_task (id);
+
+          if (!dep)
+          {
+            if (!fill)
+            {
+              MSG ("unknown dependency '%s' in line %d, ignored\n", id, task->line_nr);
+              task->state = TASK_FAILED;
+            }
+            continue;
+          }
+
+          if (partial && !(dep->reload & RELOAD_DIRTY))
+          {
+            if (!fill && required && !dep->start_ok)
+              task->dep_failed = 1;
+            continue;
+          }
+
+          if (fill)
+          {
+            dep->dependents[dep->n_dependents].task = task;
+            dep->dependents[dep->n_dependents].required = required;
+          }
+          else
+            task->n_deps++;
+          dep->n_dependents++;
+        }
+
+    if (fill)
+      break;
+
+    for (task = list; task != NULL; task = task->next)
+    {
+      if (task->n_dependents)
+      {
+        task->dependents = pool_alloc (task->n_dependents * sizeof (Dependent),
+                                       sizeof (void *));
+        if (!task->dependents)
+        {
+          MSG ("failed to allocate dependencies: %s\n", STRERROR);
+          return -1;
+        }
+      }
+      task->n_dependents = 0;
+    }
+  }
+
+  /* Kahn's algorithm: whatever can not be ordered depends on a cycle. */
+  queue = tail = NULL;
+  for (task = list; task != NULL; task = task->next)
+  {
+    task->waiting = task->n_deps;
+    task->queue_next = NULL;
+    if (!task->waiting)
+    {
+      if (tail)
+        tail->queue_next = task;
+      else
+        queue = task;
+      tail = task;
+    }
+  }
+  for (; queue != NULL; queue = queue->queue_next)
+  {
+    unsigned int i;
+
+    for (i = 0; i < queue->n_dependents; i++)
+    {
+      Task *dep = queue->dependents[i].task;
+
+      if (--dep->waiting == 0)
+      {
+        tail->queue_next = dep;
+        tail = dep;
+        dep->queue_next = NULL;
+      }
+    }
+  }
+
+  for (task = list; task != NULL; task = task->next)
+  {
+    if (task->waiting)
+    {
+      MSG ("cyclic dependency of task '%s' in line %d, ignored\n", task->id, task->line_nr);
+      task->state = TASK_FAILED;
+    }
+    task->waiting = task->n_deps;
+    task->queue_next = NULL;
+  }
+
+  return 0;
+}
+
+/* parse a config line, stripped and not a comment, into 'task' in a
+ * single pass: the fields are split at their ':' and cut short in place.
+ * 'indent' is what was stripped off its start, for the columns of errors.
+ * the tasks it is piped with are only named, to be found by
+ * find_pipe_tasks(). */
+static int
+parse_task_line (char *line,
+                 int   line_nr,
+                 int   indent,
+                 Task *task)
+{
+  char *field[5];
+  char *p;
+  char *s;
+  char *o;
+  int   n;
+
+  memset (task, 0x00, sizeof (*task));
+  task->line = pool_strdup (line);
+  if (!task->line)
+  {
+    MSG ("failed to allocate a task: %s\n", STRERROR);
+    return -1;
+  }
+  task->line_hash = hash_id (line);
+
+  parse_line = line;
+  parse_line_nr = line_nr;
+  parse_indent = indent;
+
+  /* id:action:order:pipe-id:command, the command may hold ':' */
+  field[0] = line;
+  for (n = 1, p = line; n < 5 && (p = strchr (p, ':')) != NULL; n++)
+  {
+    *p++ = '\0';
+    field[n] = p;
+  }
+  if (n < 5)
+  {
+    line_error (field[n - 1] + strlen (field[n - 1]), "missing ':'");
+    return -1;
+  }
+
+  /* id */
+  s = strstrip (field[0]);
+  if (check_valid_id (s))
+  {
+    line_error (s, "invalid id '%s'", s);
+    return -1;
+  }
+  strcpy (task->id, s);
+
+  /* action[,option...] */
+  o = strchr (field[1], ',');
+  if (o)
+    *o++ = '\0';
+  s = strstrip (field[1]);
+  if (!strcasecmp (s, "once"))
+    task->action = ACTION_ONCE;
+  else if (!strcasecmp (s, "respawn"))
+    task->action = ACTION_RESPAWN;
+  else
+  {
+    line_error (s, "invalid action '%s'", s);
+    return -1;
+  }
+
+  task->line_nr = line_nr;
+  task->window = RESTART_WINDOW;
+  task->backoff = RESTART_BACKOFF;
+  task->backoff_max = RESTART_BACKOFF_MAX;
+  task->stop_timeout = STOP_TIMEOUT;
+  if (o && parse_task_options (task, o))
+    return -1;
+
+  /* [new] order */
+  s = strstrip (field[2]);
+  if (s[0] != '\0') 
+  {                   // when order was given as an option
+    if (check_valid_order (s)) {
+      line_error (s, "invalid order '%s'", s);
+      return -1;
+    }
+    task->order = atoi(s);         // set task order
+  } 
+  else                           // when no order was given
+  {                              
+    task->order = rand() % 10000;  // give random task order
+  }
+
+  /* pipe-id */
+  s = strstrip (field[3]);
+  if (s[0] != '\0' && parse_task_id (s, task->pipe_id))
+  {
+    line_error (s, "invalid pipe-id '%s'", s);
+    return -1;
+  }
+
+  /* command */
+  s = strstrip (field[4]);
+  if (s[0] == '\0')
+  {
+    line_error (s, "empty command");
+    return -1;
+  }
+  task->command = pool_strdup (s);
+  task->argv = parse_command_argv (s);
+  if (!task->command || !task->argv)
+  {
+    line_error (s, "invalid command '%s'", s);
+    return -1;
+  }
+
+  if (0)
+    MSG ("id:%s pipe-id:%s action:%d command:%s\n",
+        task->id, task->pipe_id, task->action, task->command);
+
+  return 0;
+}
+
+/* find the tasks of earlier lines which a task is piped with, checking
+ * that it may be. */
+static int
+find_pipe_tasks (Task  *task,
+                 Task **peer,
+                 Task **from)
+{
+  Task *t;
+
+  *peer = *from = NULL;
+
+  if (task->pipe_id[0] != '\0')
+  {
+    t = lookup_task (task->pipe_id);
+    if (!t || t->line_nr >= task->line_nr)
+    {
+      MSG ("unknown pipe-id '%s' in line %d, ignored\n", task->pipe_id, task->line_nr);
+      return -1;
+    }
+    if (task->action == ACTION_RESPAWN || t->action == ACTION_RESPAWN)
+    {
+      MSG ("pipe not allowed for 'respawn' tasks in line %d, ignored\n", task->line_nr);
+      return -1;
+    }
+    if (task->listen || t->listen)
+    {
+      MSG ("pipe not allowed for socket activated tasks in line %d, ignored\n", task->line_nr);
+      return -1;
+    }
+    if (t->piped)
+    {
+      MSG ("pipe not allowed for already piped tasks in line %d, ignored\n", task->line_nr);
+      return -1;
+    }
+    *peer = t;
+  }
+
+  /* stage of a pipeline, reading the output of 'pipe-from' */
+  if (task->pipe_from_id[0] != '\0')
+  {
+    t = lookup_task (task->pipe_from_id);
+    if (!t || t->line_nr >= task->line_nr)
+    {
+      MSG ("unknown pipe-from '%s' in line %d, ignored\n", task->pipe_from_id, task->line_nr);
+      return -1;
+    }
+    if (task->action == ACTION_RESPAWN || t->action == ACTION_RESPAWN)
+    {
+      MSG ("pipe not allowed for 'respawn' tasks in line %d, ignored\n", task->line_nr);
+      return -1;
+    }
+    if (task->listen || t->listen)
+    {
+      MSG ("pipe not allowed for socket activated tasks in line %d, ignored\n", task->line_nr);
+      return -1;
+    }
+    if (*peer || t->pipe_peer || t->pipe_to)
+    {
+      MSG ("pipe not allowed for already piped tasks in line %d, ignored\n", task->line_nr);
+      return -1;
+    }
+    *from = t;
+  }
+
+  return 0;
+}
+
+static void
+link_pipe_tasks (Task *task,
+                 Task *peer,
+                 Task *from)
+{
+  if (peer)
+  {
+    task->piped = peer->piped = 1;
+    task->pipe_peer = peer;
+    peer->pipe_peer = task;
+  }
+  if (from)
+  {
+    task->piped = from->piped = 1;
+    task->pipe_from = from;
+    from->pipe_to = task;
+  }
+}
+
+/* open a config file, mapping it into memory when it is a regular file
+ * and reading it whole otherwise, e.g. from a pipe. */
+static int
+open_config (ConfigFile *config,
+             const char *path)
+{
+  struct stat st;
+  char       *data = NULL;
+  size_t      size = 0;
+  ssize_t     len = 0;
+  int         fd;
+
+  memset (config, 0x00, sizeof (*config));
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fstat (fd, &st))
+  {
+    close (fd);
+    return -1;
+  }
+
+  if (S_ISREG (st.st_mode) && st.st_size > 0)
+  {
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      madvise (data, st.st_size, MADV_SEQUENTIAL);
+      close (fd);
+      config->data = data;
+      config->size = st.st_size;
+      config->mapped = 1;
+      return 0;
+    }
+    data = NULL;
+  }
+
+  for (;;)
+  {
+    if (config->size == size)
+    {
+      char *new_data;
+
+      size = size ? size * 2 : 65536;
+      new_data = realloc (data, size);
+      if (!new_data)
+        break;
+      data = new_data;
+    }
+    len = read (fd, data + config->size, size - config->size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    config->size += len;
+  }
+  close (fd);
+  config->data = data;
+  if (len < 0 || !data)
+  {
+    free (data);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+close_config (ConfigFile *config)
+{
+  if (config->mapped)
+    munmap ((void *) config->data, config->size);
+  else
+    free ((void *) config->data);
+  free (config->line);
+}
+
+/* get the next line of a config which is neither empty nor a comment,
+ * stripped of white spaces, of any length. it is copied once to be cut
+ * into fields, and stays valid until the next call. */
+static char *
+next_config_line (ConfigFile *config)
+{
+  while (config->pos < config->size)
+  {
+    const char *start = config->data + config->pos;
+    const char *end;
+    size_t      len;
+
+    end = memchr (start, '\n', config->size - config->pos);
+    if (!end)
+      end = config->data + config->size;
+    config->pos = end - config->data + 1;
+    config->line_nr++;
+
+    for (config->indent = 0; start < end && isspace (*start); start++)
+      config->indent++;
+    while (end > start && isspace (end[-1]))
+      end--;
+
+    /* comment or empty line */
+    if (start == end || start[0] == '#')
+      continue;
+
+    len = end - start;
+    if (len >= config->line_size)
+    {
+      size_t size = config->line_size ? config->line_size : 256;
+      char  *line;
+
+      while (size <= len)
+        size *= 2;
+      line = realloc (config->line, size);
+      if (!line)
+      {
+        MSG ("failed to read line %d: %s\n", config->line_nr, STRERROR);
+        continue;
+      }
+      config->line = line;
+      config->line_size = size;
+    }
+    memcpy (config->line, start, len);
+    config->line[len] = '\0';
+
+    if (0)
+      MSG ("config[%3d] %s\n", config->line_nr, config->line);
+
+    return config->line;
+  }
+
+  return NULL;
+}
+
+/* what a cache is valid for: the config it was compiled from. */
+typedef struct _CacheKey CacheKey;
+struct _CacheKey
+{
+  unsigned long long mtime_sec;
+  unsigned long long mtime_nsec;
+  unsigned long long size;
+  unsigned long long hash;
+};
+
+/* a compiled config: this header, the tasks in config order, then their
+ * strings. strings are offsets into the string block, 0 for none. */
+typedef struct _CacheHeader CacheHeader;
+struct _CacheHeader
+{
+  char               magic[8];
+  unsigned int       version;
+  unsigned int       task_size;         // sizeof (CachedTask), for other builds
+  CacheKey           key;
+  unsigned int       n_tasks;
+  unsigned int       strings_size;
+};
+
+typedef struct _CachedTask CachedTask;
+struct _CachedTask
+{
+  char               id[ID_MAX + 1];
+  unsigned char      action;
+  unsigned char      packet;
+  unsigned char      pad;
+  int                peer;              // index of the task named by pipe-id, or -1
+  int                from;              // index of the task named by pipe-from, or -1
+  unsigned int       order;
+  unsigned int       line_nr;
+  unsigned int       line_hash;
+  unsigned int       max_restarts;
+  unsigned int       window;
+  unsigned int       backoff;
+  unsigned int       backoff_max;
+  unsigned int       stop_timeout;
+  unsigned int       idle_timeout;
+  unsigned int       cpu_max;
+  unsigned int       n_args;
+  unsigned int       line;
+  unsigned int       command;           // offset in the line, which ends with it
+  unsigned int       argv;              // the arguments one after the other
+  unsigned int       after;
+  unsigned int       requires;
+  unsigned int       tap;
+  unsigned int       listen;
+  unsigned long long pipe_size;
+  unsigned long long memory_max;
+};
+
+#define CACHE_MAGIC "PMCACHE"
+#define CACHE_VERSION 3
+
+/* hash a config a word at a time, far quicker than parsing it. */
+static unsigned long long
+hash_bytes (const char *data,
+            size_t      size)
+{
+  unsigned long long h = 0x9e3779b97f4a7c15ULL ^ size;
+  unsigned long long w;
+  size_t             i;
+
+  for (i = 0; i + 8 <= size; i += 8)
+  {
+    memcpy (&w, data + i, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  w = 0;
+  memcpy (&w, data + i, size - i);
+  h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+
+  return h ^ (h >> 29);
+}
+
+static int
+get_cache_key (const char *path,
+               ConfigFile *config,
+               CacheKey   *key)
+{
+  struct stat st;
+
+  if (stat (path, &st))
+    return -1;
+
+  memset (key, 0x00, sizeof (*key));
+  key->mtime_sec = st.st_mtim.tv_sec;
+  key->mtime_nsec = st.st_mtim.tv_nsec;
+  key->size = config->size;
+  key->hash = hash_bytes (config->data, config->size);
+
+  return 0;
+}
+
+/* load the tasks of a compiled config, if it is one of this config. its
+ * strings are used in place, so it stays mapped. */
+static int
+load_config_cache (const char     *path,
+                   const CacheKey *key)
+{
+  const CacheHeader *header;
+  const CachedTask  *cached;
+  const char        *strings;
+  struct stat        st;
+  Task             **loaded;
+  void              *data;
+  unsigned int       i;
+  int                fd;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fstat (fd, &st) || st.st_size < (off_t) sizeof (CacheHeader))
+  {
+    close (fd);
+    return -1;
+  }
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    return -1;
+
+  header = data;
+  cached = (const CachedTask *) (header + 1);
+  strings = (const char *) (cached + header->n_tasks);
+  if (memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) ||
+      header->version != CACHE_VERSION || header->task_size != sizeof (CachedTask) ||
+      memcmp (&header->key, key, sizeof (*key)) ||
+      header->n_tasks > (st.st_size - sizeof (CacheHeader)) / sizeof (CachedTask) ||
+      header->strings_size == 0 ||
+      header->strings_size != st.st_size - sizeof (CacheHeader) -
+                              header->n_tasks * sizeof (CachedTask) ||
+      strings[header->strings_size - 1] != '\0')
+    goto stale;
+
+  /* a damaged cache must not take procman down */
+  for (i = 0; i < header->n_tasks; i++)
+  {
+    const CachedTask *c = &cached[i];
+
+    if (c->id[ID_MAX] || c->peer >= (int) i || c->from >= (int) i ||
+        c->order >= ORDER_LIMIT || !c->line || c->line >= header->strings_size ||
+        c->command > strlen (strings + c->line) || !c->argv || !c->n_args ||
+        c->argv >= header->strings_size || c->after >= header->strings_size ||
+        c->requires >= header->strings_size || c->tap >= header->strings_size ||
+        c->listen >= header->strings_size)
+      goto stale;
+  }
+
+  loaded = malloc ((header->n_tasks + 1) * sizeof (Task *));
+  if (!loaded)
+    goto stale;
+
+  for (i = 0; i < header->n_tasks; i++)
+  {
+    const CachedTask *c = &cached[i];
+    const char       *arg;
+    Task              task;
+    unsigned int      n;
+
+    memset (&task, 0x00, sizeof (task));
+    strcpy (task.id, c->id);
+    if (c->peer >= 0)
+      strcpy (task.pipe_id, cached[c->peer].id);
+    if (c->from >= 0)
+      strcpy (task.pipe_from_id, cached[c->from].id);
+    task.action = c->action;
+    task.packet = c->packet;
+    task.order = c->order;
+    task.line_nr = c->line_nr;
+    task.line_hash = c->line_hash;
+    task.max_restarts = c->max_restarts;
+    task.window = c->window;
+    task.backoff = c->backoff;
+    task.backoff_max = c->backoff_max;
+    task.stop_timeout = c->stop_timeout;
+    task.idle_timeout = c->idle_timeout;
+    task.cpu_max = c->cpu_max;
+    task.pipe_size = c->pipe_size;
+    task.memory_max = c->memory_max;
+    task.line = strings + c->line;
+    task.command = task.line + c->command;
+    task.after = c->after ? strings + c->after : NULL;
+    task.requires = c->requires ? strings + c->requires : NULL;
+    task.tap = c->tap ? strings + c->tap : NULL;
+    task.listen = c->listen ? strings + c->listen : NULL;
+
+    task.argv = pool_alloc ((c->n_args + 1) * sizeof (char *), sizeof (char *));
+    if (!task.argv)
+    {
+      MSG ("failed to allocate a command vector: %s\n", STRERROR);
+      loaded[i] = NULL;
+      continue;
+    }
+    arg = strings + c->argv;
+    for (n = 0; n < c->n_args && arg < strings + header->strings_size; n++)
+    {
+      task.argv[n] = (char *) arg;
+      arg += strlen (arg) + 1;
+    }
+    task.argv[n] = NULL;
+
+    loaded[i] = append_task (&task);
+    if (loaded[i])
+      link_pipe_tasks (loaded[i], c->peer >= 0 ? loaded[c->peer] : NULL,
+                       c->from >= 0 ? loaded[c->from] : NULL);
+  }
+  free (loaded);
+
+  return 0;
+
+stale:
+  munmap (data, st.st_size);
+  return -1;
+}
+
+static void
+write_cache_string (FILE               *fp,
+                    const char         *str,
+                    size_t              len,
+                    unsigned int       *offset,
+                    unsigned long long *size)
+{
+  if (!str)
+  {
+    *offset = 0;
+    return;
+  }
+  *offset = *size;
+  *size += len;
+  if (fp)
+    fwrite (str, 1, len, fp);
+}
+
+/* walk the strings of a task in the order they are written, writing
+ * them if 'fp' is given and only adding up their offsets otherwise. */
+static void
+write_cache_strings (FILE               *fp,
+                     Task               *task,
+                     CachedTask         *c,
+                     unsigned long long *size)
+{
+  const char *last;
+  int         n;
+
+  for (n = 0; task->argv[n]; n++)
+    ;
+  last = task->argv[n - 1];
+  c->n_args = n;
+
+  write_cache_string (fp, task->line, strlen (task->line) + 1, &c->line, size);
+  c->command = strlen (task->line) - strlen (task->command);
+  write_cache_string (fp, task->argv[0], last + strlen (last) + 1 - task->argv[0],
+                      &c->argv, size);
+  write_cache_string (fp, task->after, task->after ? strlen (task->after) + 1 : 0,
+                      &c->after, size);
+  write_cache_string (fp, task->requires, task->requires ? strlen (task->requires) + 1 : 0,
+                      &c->requires, size);
+  write_cache_string (fp, task->tap, task->tap ? strlen (task->tap) + 1 : 0, &c->tap, size);
+  write_cache_string (fp, task->listen, task->listen ? strlen (task->listen) + 1 : 0,
+                      &c->listen, size);
+}
+
+/* compile the loaded tasks into a cache, replacing it at once so that a
+ * procman which has the old one mapped keeps it whole. */
+static void
+save_config_cache (const char     *path,
+                   const CacheKey *key)
+{
+  CacheHeader        header;
+  TaskChunk         *chunk;
+  Task              *task;
+  FILE              *fp;
+  char              *tmp;
+  unsigned long long size;
+  int                pass;
+  int                err;
+
+  if (asprintf (&tmp, "%s.tmp", path) < 0)
+    return;
+
+  fp = fopen (tmp, "w");
+  if (!fp)
+  {
+    MSG ("failed to write config cache '%s': %s\n", path, STRERROR);
+    free (tmp);
+    return;
+  }
+
+  memset (&header, 0x00, sizeof (header));
+  memcpy (header.magic, CACHE_MAGIC, sizeof (header.magic));
+  header.version = CACHE_VERSION;
+  header.task_size = sizeof (CachedTask);
+  header.key = *key;
+  header.n_tasks = n_tasks;
+  fwrite (&header, sizeof (header), 1, fp);
+
+  /* the tasks with the offsets of their strings, then the strings, the
+   * first one being the empty string of offset 0 */
+  for (pass = 0; pass < 2; pass++)
+  {
+    size = 1;
+    if (pass)
+      fputc ('\0', fp);
+
+    FOR_EACH_TASK (chunk, task)
+    {
+      CachedTask c;
+
+      memset (&c, 0x00, sizeof (c));
+      write_cache_strings (pass ? fp : NULL, task, &c, &size);
+      if (pass)
+        continue;
+
+      strcpy (c.id, task->id);
+      c.action = task->action;
+      c.packet = task->packet;
+      c.peer = task->pipe_id[0] && task->pipe_peer ? (int) task->pipe_peer->index : -1;
+      c.from = task->pipe_from ? (int) task->pipe_from->index : -1;
+      c.order = task->order;
+      c.line_nr = task->line_nr;
+      c.line_hash = task->line_hash;
+      c.max_restarts = task->max_restarts;
+      c.window = task->window;
+      c.backoff = task->backoff;
+      c.backoff_max = task->backoff_max;
+      c.stop_timeout = task->stop_timeout;
+      c.idle_timeout = task->idle_timeout;
+      c.cpu_max = task->cpu_max;
+      c.pipe_size = task->pipe_size;
+      c.memory_max = task->memory_max;
+      fwrite (&c, sizeof (c), 1, fp);
+    }
+  }
+
+  header.strings_size = size;
+  err = size > 0xffffffffULL;           // too large for the offsets
+  err = err || ferror (fp) || fseek (fp, 0, SEEK_SET) || fwrite (&header, sizeof (header), 1, fp) != 1;
+  if (fclose (fp) || err || rename (tmp, path))
+  {
+    MSG ("failed to write config cache '%s': %s\n", path, STRERROR);
+    unlink (tmp);
+  }
+  free (tmp);
+}
+
+/* load the config, from its cache if it is given one and the cache is
+ * up to date. a config with invalid lines is not cached, so that they are
+ * reported every time. */
+static int
+read_config (const char *filename)
+{
+  ConfigFile   config;
+  CacheKey     key;
+  TaskChunk   *chunk;
+  Task        *t;
+  Task        *tail;
+  char        *line;
+  int          cache;
+  unsigned int n_lines = 0;
+
+  if (open_config (&config, filename))
+    return -1;
+
+  tasks = NULL;
+
+  cache = cache_path && !get_cache_key (filename, &config, &key);
+  if (cache && !load_config_cache (cache_path, &key))
+  {
+    close_config (&config);
+    cache = 0;
+    goto loaded;
+  }
+
+  while ((line = next_config_line (&config)) != NULL)
+  {
+    Task  task;
+    Task *peer;
+    Task *from;
+
+    n_lines++;
+    if (parse_task_line (line, config.line_nr, config.indent, &task))
+      continue;
+    if (lookup_task (task.id))
+    {
+      line_error (line, "duplicate id '%s'", task.id);
+      continue;
+    }
+    if (find_pipe_tasks (&task, &peer, &from))
+      continue;
+
+    t = append_task (&task);
+    if (t)
+      link_pipe_tasks (t, peer, from);
+  }
+
+  close_config (&config);
+  if (cache && n_tasks == n_lines)
+    save_config_cache (cache_path, &key);
+
+loaded:
+  /* dependencies are resolved over the pool in place, then sorted */
+  tail = NULL;
+  FOR_EACH_TASK (chunk, t)
+  {
+    if (tail)
+      tail->next = t;
+    else
+      tasks = t;
+    tail = t;
+  }
+  if (tail)
+    tail->next = NULL;
+
+  if (resolve_dependencies (tasks, 0))
+    return -1;
+
+  return sort_tasks ();
+}
+
+/* format a pid in decimal, without the locale and malloc of printf, as a
+ * forked child of a threaded procman may only make async-signal-safe calls. */
+static void
+format_pid (char *buf,
+            pid_t pid)
+{
+  char digits[16];
+  int  n = 0;
+
+  do
+    digits[n++] = '0' + pid % 10;
+  while ((pid /= 10) > 0);
+  while (n)
+    *buf++ = digits[--n];
+  *buf = '\0';
+}
+
+/* report a failure of a forked child, which has no stdio either. */
+static void
+child_msg (const char *what,
+           const char *id)
+{
+  struct iovec iov[3];
+
+  iov[0].iov_base = (char *) what;
+  iov[0].iov_len = strlen (what);
+  iov[1].iov_base = (char *) id;
+  iov[1].iov_len = strlen (id);
+  iov[2].iov_base = (char *) "'\n";
+  iov[2].iov_len = 2;
+  writev (2, iov, 3);
+}
+
+/* move a process into a cgroup, 0 for the calling one. it may be called
+ * by a forked child. */
+static int
+join_cgroup (int   cgroup_fd,
+             pid_t pid)
+{
+  char buf[16];
+  int  fd;
+  int  len;
+
+  fd = openat (cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  format_pid (buf, pid);
+  len = strlen (buf);
+  if (write (fd, buf, len) != len)
+    len = -1;
+  close (fd);
+
+  return len < 0 ? -1 : 0;
+}
+
+static void
+write_cgroup (Task       *task,
+              int         cgroup_fd,
+              const char *file,
+              const char *format,
+              ...)
+{
+  va_list args;
+  char    buf[64];
+  int     fd;
+  int     len;
+
+  va_start (args, format);
+  len = vsnprintf (buf, sizeof (buf), format, args);
+  va_end (args);
+
+  fd = openat (cgroup_fd, file, O_WRONLY | O_CLOEXEC);
+  if (fd < 0 || write (fd, buf, len) != len)
+    MSG ("failed to set %s of program '%s': %s\n", file, task->id, STRERROR);
+  if (fd >= 0)
+    close (fd);
+}
+
+/* open the cgroup leaf of a task, creating it and setting its limits the
+ * first time. */
+static int
+open_task_cgroup (Task *task)
+{
+  int fd;
+
+  if (cgroup_root_fd < 0)
+    return -1;
+
+  if (!task->cgroup_made && mkdirat (cgroup_root_fd, task->id, 0755) && errno != EEXIST)
+  {
+    MSG ("failed to create the cgroup of program '%s': %s\n", task->id, STRERROR);
+    return -1;
+  }
+
+  fd = openat (cgroup_root_fd, task->id, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    MSG ("failed to open the cgroup of program '%s': %s\n", task->id, STRERROR);
+    return -1;
+  }
+
+  if (!task->cgroup_made)
+  {
+    task->cgroup_made = 1;
+    if (task->memory_max)
+      write_cgroup (task, fd, "memory.max", "%llu", task->memory_max);
+    else if (task->spawns)              // the limit was dropped by a reload
+      write_cgroup (task, fd, "memory.max", "max");
+    if (task->cpu_max)
+      write_cgroup (task, fd, "cpu.max", "%u 100000", task->cpu_max * 1000);
+    else if (task->spawns)
+      write_cgroup (task, fd, "cpu.max", "max 100000");
+  }
+
+  return fd;
+}
+
+/* enable the controllers of the limits for the task cgroups, which are
+ * created below 'cgroup_root'. */
+static void
+setup_cgroups (void)
+{
+  TaskChunk *chunk;
+  Task      *task;
+  int        fd;
+
+  if (!cgroup_root)
+  {
+    FOR_EACH_TASK (chunk, task)
+      if (task->memory_max || task->cpu_max)
+        MSG ("limits of program '%s' need a cgroup (-c), ignored\n", task->id);
+    return;
+  }
+
+  if (mkdir (cgroup_root, 0755) && errno != EEXIST)
+  {
+    MSG ("failed to create cgroup '%s': %s\n", cgroup_root, STRERROR);
+    return;
+  }
+  cgroup_root_fd = open (cgroup_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (cgroup_root_fd < 0)
+  {
+    MSG ("failed to open cgroup '%s': %s\n", cgroup_root, STRERROR);
+    return;
+  }
+
+  fd = openat (cgroup_root_fd, "cgroup.subtree_control", O_WRONLY | O_CLOEXEC);
+  if (fd < 0 || write (fd, "+memory +cpu", 12) != 12)
+    MSG ("failed to enable the controllers of cgroup '%s': %s\n", cgroup_root, STRERROR);
+  if (fd >= 0)
+    close (fd);
+}
+
+/* remove the cgroups of the tasks, which are empty once they are reaped. */
+static void
+remove_cgroups (void)
+{
+  TaskChunk *chunk;
+  Task      *task;
+
+  FOR_EACH_TASK (chunk, task)
+    if (task->cgroup_made && task->pid <= 0 &&
+        unlinkat (cgroup_root_fd, task->id, AT_REMOVEDIR))
+      MSG ("failed to remove the cgroup of program '%s': %s\n", task->id, STRERROR);
+}
+
+/* remove a unix socket left at 'path', but nothing else which is there. */
+static int
+unlink_socket (const char *path)
+{
+  struct stat st;
+
+  if (lstat (path, &st))
+    return errno == ENOENT ? 0 : -1;
+  if (!S_ISSOCK (st.st_mode))
+  {
+    errno = EEXIST;
+    return -1;
+  }
+
+  return unlink (path);
+}
+
+/* remove the unix socket 'fd' was bound to, if that is still there. */
+static void
+unlink_bound_socket (int fd)
+{
+  struct sockaddr_un addr;
+  socklen_t          len = sizeof (addr);
+
+  if (!getsockname (fd, (struct sockaddr *) &addr, &len) &&
+      addr.sun_family == AF_UNIX && addr.sun_path[0] && unlink_socket (addr.sun_path))
+    MSG ("failed to remove socket '%s': %s\n", addr.sun_path, STRERROR);
+}
+
+/* bind the listening socket of a socket activated task: a unix socket if
+ * the address is a path, a tcp one for '[host@]port' otherwise, as a ':'
+ * would end the options. it is left blocking, as procman only polls it
+ * and the task gets it as it is. */
+static int
+open_listener (const char *address)
+{
+  struct sockaddr_un addr;
+  struct addrinfo    hints;
+  struct addrinfo   *ai;
+  char               host[256];
+  const char        *port;
+  int                fd;
+  int                one = 1;
+
+  if (strchr (address, '/'))
+  {
+    memset (&addr, 0x00, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen (address) >= sizeof (addr.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    strcpy (addr.sun_path, address);
+
+    if (unlink_socket (address))        // left over by a previous run
+      return -1;
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+      return -1;
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+        listen (fd, LISTEN_BACKLOG))
+    {
+      close (fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  port = strchr (address, '@');
+  if (port && (size_t) (port - address) < sizeof (host))
+  {
+    sprintf (host, "%.*s", (int) (port - address), address);
+    port++;
+  }
+  else if (port)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  else
+    port = address;
+
+  memset (&hints, 0x00, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  if (getaddrinfo (port != address ? host : NULL, port, &hints, &ai))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = socket (ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+  if (fd >= 0 &&
+      (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one)) ||
+       bind (fd, ai->ai_addr, ai->ai_addrlen) || listen (fd, LISTEN_BACKLOG)))
+  {
+    close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (ai);
+
+  return fd;
+}
+
+/* the environment of a socket activated task: that of procman without
+ * stale LISTEN_ variables, plus the ones sd_listen_fds() reads. the child
+ * writes its pid into 'pid_var' itself. */
+static char **
+listen_environ (Task *task,
+                char *pid_var)
+{
+  char  **envp;
+  char   *names;
+  size_t  n;
+  size_t  i;
+  size_t  j;
+
+  for (n = 0; environ[n]; n++)
+    ;
+  envp = malloc ((n + 4) * sizeof (char *) + sizeof ("LISTEN_FDNAMES=") + strlen (task->id));
+  if (!envp)
+    return NULL;
+  names = (char *) (envp + n + 4);
+  sprintf (names, "LISTEN_FDNAMES=%s", task->id);
+  strcpy (pid_var, "LISTEN_PID=");
+
+  for (i = j = 0; i < n; i++)
+    if (strncmp (environ[i], "LISTEN_", 7))
+      envp[j++] = environ[i];
+  envp[j++] = (char *) "LISTEN_FDS=1";
+  envp[j++] = pid_var;
+  envp[j++] = names;
+  envp[j] = NULL;
+
+  return envp;
+}
+
+/* the readiness pipe is O_CLOEXEC, so the child closes its end by a
+ * successful execvp(), or writes the errno of a failed one first. the
+ * read end is returned in 'ready_fd' to be watched by the event loop. */
+static pid_t
+spawn_task_fork (Task *task,
+                 int  *ready_fd)
+{
+  pid_t   pid;
+  int     ready[2];
+  char  **envp = environ;
+  char    pid_var[32];
+
+  if (task->listen_watch.fd >= 0 && !(envp = listen_environ (task, pid_var)))
+  {
+    MSG ("failed to allocate the environment of program '%s': %s\n", task->id, STRERROR);
+    return -1;
+  }
+
+  if (pipe2 (ready, O_CLOEXEC | O_NONBLOCK))
+  {
+    MSG ("failed to pipe() for program '%s': %s\n", task->id, STRERROR);
+    ready[0] = ready[1] = -1;
+  }
+
+  pid = fork ();
+  if (pid < 0)
+  {
+    MSG ("failed to fork() for program '%s': %s\n", task->id, STRERROR);
+    if (ready[0] >= 0)
+    {
+      close (ready[0]);
+      close (ready[1]);
+    }
+    if (envp != environ)
+      free (envp);
+    return pid;
+  }
+
+  /* child process */
+  if (pid == 0)
+  {
+    int err;
+
+    if (ready[0] >= 0)
+      close (ready[0]);
+
+    /* every other pipe end is O_CLOEXEC */
+    if (task->log_fd >= 0)
+    {
+      dup2 (task->log_fd, 1);
+      dup2 (task->log_fd, 2);
+    }
+    if (task->stdout_fd >= 0)
+      dup2 (task->stdout_fd, 1);
+    if (task->stdin_fd >= 0)
+      dup2 (task->stdin_fd, 0);
+
+    if (task->cgroup_fd >= 0 && join_cgroup (task->cgroup_fd, 0))
+      child_msg ("failed to join the cgroup of program '", task->id);
+
+    /* the socket of a socket activated task goes to fd 3, like LISTEN_FDS says */
+    if (envp != environ)
+    {
+      if (ready[1] == LISTEN_FDS_START)
+        ready[1] = fcntl (ready[1], F_DUPFD_CLOEXEC, LISTEN_FDS_START + 1);
+      if (task->listen_watch.fd == LISTEN_FDS_START)
+        fcntl (LISTEN_FDS_START, F_SETFD, 0);
+      else
+        dup2 (task->listen_watch.fd, LISTEN_FDS_START);
+      format_pid (pid_var + strlen ("LISTEN_PID="), getpid ());
+    }
+
+    if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1) // [new] unblock signals before executed.
+      child_msg ("failed to unblock the signals of program '", task->id);
+
+    /* the event loop reports the errno written to the readiness pipe */
+    execvpe (task->argv[0], task->argv, envp);
+    err = errno;
+    if (ready[1] < 0 || write (ready[1], &err, sizeof (err)) != sizeof (err))
+      child_msg ("failed to execute program '", task->id);
+    _exit (-1);
+  }
+
+  if (ready[0] >= 0)
+    close (ready[1]);
+  *ready_fd = ready[0];
+  if (envp != environ)
+    free (envp);
+
+  return pid;
+}
+
+/* posix_spawnp() shares the address space with the child until exec, so
+ * its cost does not grow with the page tables of procman, and it only
+ * returns once the exec has succeeded or failed. */
+static pid_t
+spawn_task_posix (Task *task)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t          attr;
+  sigset_t                   sigmask;
+  pid_t                      pid;
+  int                        signo;
+  int                        err;
+  short                      flags;
+
+  posix_spawn_file_actions_init (&actions);
+  if (task->log_fd >= 0)
+  {
+    posix_spawn_file_actions_adddup2 (&actions, task->log_fd, 1);
+    posix_spawn_file_actions_adddup2 (&actions, task->log_fd, 2);
+  }
+  if (task->stdout_fd >= 0)
+    posix_spawn_file_actions_adddup2 (&actions, task->stdout_fd, 1);
+  if (task->stdin_fd >= 0)
+    posix_spawn_file_actions_adddup2 (&actions, task->stdin_fd, 0);
+
+  /* [new] unblock signals in the executed program. */
+  posix_spawnattr_init (&attr);
+  sigprocmask (SIG_SETMASK, NULL, &sigmask);
+  for (signo = 1; signo < NSIG; signo++)
+    if (sigismember (&mask, signo))
+      sigdelset (&sigmask, signo);
+  posix_spawnattr_setsigmask (&attr, &sigmask);
+  flags = POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_SETCGROUP
+  if (task->cgroup_fd >= 0)
+  {
+    posix_spawnattr_setcgroup_np (&attr, task->cgroup_fd);
+    flags |= POSIX_SPAWN_SETCGROUP;
+  }
+#endif
+  posix_spawnattr_setflags (&attr, flags);
+
+  err = posix_spawnp (&pid, task->argv[0], &actions, &attr, task->argv, environ);
+  if (err)
+  {
+    MSG ("failed to execute command '%s': %s\n", task->command, strerror (err));
+    pid = 0;
+  }
+#ifndef POSIX_SPAWN_SETCGROUP
+  else if (task->cgroup_fd >= 0 && join_cgroup (task->cgroup_fd, pid))  // after exec
+    MSG ("failed to join the cgroup of program '%s': %s\n", task->id, STRERROR);
+#endif
+
+  posix_spawnattr_destroy (&attr);
+  posix_spawn_file_actions_destroy (&actions);
+
+  return pid;
+}
+
+static void
+close_relay (Relay *relay)
+{
+  if (relay->dropped)
+    MSG ("tap of program '%s' dropped %llu bytes\n", relay->task->id, relay->dropped);
+
+  if (!relay->in_hup)
+    remove_watch (&relay->in_watch);
+  remove_watch (&relay->out_watch);
+  close (relay->in_watch.fd);
+  close (relay->out_watch.fd);
+  close (relay->tap[0]);
+  close (relay->tap[1]);
+  close (relay->tap_fd);
+  close (relay->null_fd);
+
+  /* events of this batch may still point to it */
+  relay->in_watch.fd = relay->out_watch.fd = -1;
+  relay->next = closed_relays;
+  closed_relays = relay;
+}
+
+static void
+block_relay (Relay *relay,
+             int    blocked)
+{
+  if (relay->blocked == blocked)
+    return;
+  relay->blocked = blocked;
+
+  if (!relay->in_hup)
+    modify_watch (&relay->in_watch, blocked ? 0 : EPOLLIN);
+  modify_watch (&relay->out_watch, blocked ? EPOLLOUT : 0);
+}
+
+/* move the tap pipe into the tap file. a fifo or a socket which does not
+ * take it right away has the rest thrown away; a regular file is always
+ * written in full, as fast as its disk goes, as it never returns EAGAIN. */
+static void
+drain_tap (Relay *relay)
+{
+  ssize_t n;
+
+  while ((n = splice (relay->tap[0], NULL, relay->tap_fd, NULL, RELAY_CHUNK,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0)
+    ;
+  if (n < 0 && errno != EAGAIN)
+    MSG ("failed to write the tap of program '%s': %s\n", relay->task->id, STRERROR);
+
+  if (n < 0)
+    while ((n = splice (relay->tap[0], NULL, relay->null_fd, NULL, RELAY_CHUNK,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0)
+      relay->dropped += n;
+}
+
+static void
+pump_relay (Relay *relay)
+{
+  ssize_t n;
+
+  for (;;)
+  {
+    if (!relay->pending)
+    {
+      n = tee (relay->in_watch.fd, relay->tap[1], RELAY_CHUNK, SPLICE_F_NONBLOCK);
+      if (n == 0)                         // writer closed and pipe is empty
+        break;
+      if (n < 0)
+      {
+        if (errno == EAGAIN)
+        {
+          block_relay (relay, 0);
+          return;
+        }
+        MSG ("failed to tee() for program '%s': %s\n", relay->task->id, STRERROR);
+        break;
+      }
+      relay->pending = n;
+      drain_tap (relay);
+    }
+
+    n = splice (relay->in_watch.fd, NULL, relay->out_watch.fd, NULL, relay->pending,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n < 0)
+    {
+      if (errno == EAGAIN)
+      {
+        block_relay (relay, 1);
+        return;
+      }
+      if (errno != EPIPE)                 // reader closed
+        MSG ("failed to splice() for program '%s': %s\n", relay->task->id, STRERROR);
+      break;
+    }
+    relay->pending -= n;
+  }
+
+  close_relay (relay);
+}
+
+/* a hangup is reported even with no events asked for, so it is handled
+ * here rather than left to fire again on every turn. */
+static void
+handle_relay_in (Watch       *watch,
+                 unsigned int events)
+{
+  Relay *relay = (Relay *) ((char *) watch - offsetof (Relay, in_watch));
+
+  /* the writer is gone while the reader is slow: drain what is left by
+   * the out watch alone, until tee() sees the end */
+  if ((events & (EPOLLHUP | EPOLLERR)) && relay->blocked)
+  {
+    remove_watch (watch);
+    relay->in_hup = 1;
+    return;
+  }
+
+  pump_relay (relay);
+}
+
+static void
+handle_relay_out (Watch       *watch,
+                  unsigned int events)
+{
+  Relay *relay = (Relay *) ((char *) watch - offsetof (Relay, out_watch));
+
+  if (events & (EPOLLHUP | EPOLLERR))   // the reader is gone
+  {
+    close_relay (relay);
+    return;
+  }
+
+  pump_relay (relay);
+}
+
+/* grow the buffer of a pipe written by 'task', so that a fast writer
+ * does not stall on the default 64 KiB. */
+static void
+set_pipe_size (int   fd,
+               Task *task)
+{
+  if (task->pipe_size && fcntl (fd, F_SETPIPE_SZ, (int) task->pipe_size) < 0)
+    MSG ("failed to set pipe size %llu for program '%s': %s\n",
+         task->pipe_size, task->id, STRERROR);
+}
+
+/* create a pipe written by 'task'. in packet mode every write() is read
+ * back by a single read(), so a message keeps its boundaries without any
+ * framing; splice() moves whole packets, so a relay keeps them too. */
+static int
+open_pipe (int   fds[2],
+           Task *task)
+{
+  if (!task->packet)
+    return pipe2 (fds, O_CLOEXEC);
+
+  if (!pipe2 (fds, O_CLOEXEC | O_DIRECT))
+    return 0;
+  MSG ("failed to create a packet pipe for program '%s': %s\n", task->id, STRERROR);
+
+  return pipe2 (fds, O_CLOEXEC);
+}
+
+/* connect 'writer' to 'reader' through a pipe, with a relay in between
+ * when the traffic is tapped into 'tap_fd'. */
+static int
+open_channel (Task *writer,
+              Task *reader,
+              int   tap_fd)
+{
+  Relay *relay;
+  int    fds[2];
+  int    out[2];
+
+  if (open_pipe (fds, writer))
+    return -1;
+  set_pipe_size (fds[1], writer);
+  writer->stdout_fd = fds[1];
+  reader->stdin_fd = fds[0];
+  if (tap_fd < 0)
+    return 0;
+
+  relay = calloc (1, sizeof (Relay));
+  if (!relay)
+    return -1;
+  relay->task = writer;
+  relay->tap_fd = fcntl (tap_fd, F_DUPFD_CLOEXEC, 0);
+  relay->null_fd = open ("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (relay->tap_fd < 0 || relay->null_fd < 0 ||
+      pipe2 (relay->tap, O_CLOEXEC | O_NONBLOCK) || open_pipe (out, writer))
+  {
+    if (relay->tap_fd >= 0)
+      close (relay->tap_fd);
+    if (relay->null_fd >= 0)
+      close (relay->null_fd);
+    if (relay->tap[0] > 0)
+    {
+      close (relay->tap[0]);
+      close (relay->tap[1]);
+    }
+    free (relay);
+    return -1;
+  }
+
+  set_pipe_size (out[1], writer);
+  set_pipe_size (relay->tap[1], writer);
+  fcntl (fds[0], F_SETFL, O_NONBLOCK);  // only procman's ends are non-blocking
+  fcntl (out[1], F_SETFL, O_NONBLOCK);
+  reader->stdin_fd = out[0];
+  add_watch (&relay->in_watch, fds[0], EPOLLIN, handle_relay_in);
+  add_watch (&relay->out_watch, out[1], 0, handle_relay_out);
+
+  return 0;
+}
+
+/* open a tap file for appending. splice() needs it opened without
+ * O_APPEND, so seek to its end instead. */
+static int
+open_tap (const char *tap,
+          Task       *task)
+{
+  int fd;
+
+  fd = open (tap, O_WRONLY | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+  if (fd < 0 || lseek (fd, 0, SEEK_END) < 0)
+  {
+    MSG ("failed to open tap '%s' for program '%s': %s\n", tap, task->id, STRERROR);
+    if (fd >= 0)
+      close (fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* connect two stages of a pipeline, tapping the traffic if the writer
+ * asks for it. */
+static void
+open_stage_pipe (Task *writer,
+                 Task *reader)
+{
+  int tap_fd = -1;
+
+  reader->stdin_open = 1;
+  if (writer->tap)
+    tap_fd = open_tap (writer->tap, writer);
+
+  if (open_channel (writer, reader, tap_fd))
+    MSG ("failed to pipe() for program '%s': %s\n", writer->id, STRERROR);
+
+  if (tap_fd >= 0)
+    close (tap_fd);
+}
+
+static void close_task_pipes (Task *task);
+
+/* create the pipes of a task when it or a task it is piped with is
+ * spawned first. both directions of a tapped pair share the offset of
+ * the tap file. */
+static void
+open_task_pipes (Task *task)
+{
+  Task       *peer = task->pipe_peer;
+  const char *tap;
+  int         tap_fd = -1;
+
+  if (task->pipe_from && !task->stdin_open)
+    open_stage_pipe (task->pipe_from, task);
+  if (task->pipe_to && !task->pipe_to->stdin_open)
+    open_stage_pipe (task, task->pipe_to);
+
+  /* a stage which will never start holds no pipe ends, so that the
+   * rest of the pipeline sees EOF or EPIPE instead of waiting for it */
+  if (task->pipe_from && task->pipe_from->state == TASK_FAILED)
+    close_task_pipes (task->pipe_from);
+  if (task->pipe_to && task->pipe_to->state == TASK_FAILED)
+    close_task_pipes (task->pipe_to);
+
+  if (!peer || task->pipes_open)
+    return;
+  task->pipes_open = peer->pipes_open = 1;
+
+  tap = task->tap ? task->tap : peer->tap;
+  if (tap)
+    tap_fd = open_tap (tap, task);
+
+  if (open_channel (task, peer, tap_fd) || open_channel (peer, task, tap_fd))
+  {
+    MSG ("failed to pipe() for prgoram '%s': %s\n", task->id, STRERROR);
+    task->piped = peer->piped = 0;
+  }
+
+  if (tap_fd >= 0)
+    close (tap_fd);
+}
+
+/* the child owns its pipe ends now, procman keeps none of them. */
+static void
+close_task_pipes (Task *task)
+{
+  if (task->stdin_fd >= 0)
+    close (task->stdin_fd);
+  if (task->stdout_fd >= 0)
+    close (task->stdout_fd);
+  if (task->log_fd >= 0)
+    close (task->log_fd);
+  task->stdin_fd = task->stdout_fd = task->log_fd = -1;
+}
+
+static void
+queue_log_chunk (LogChunk *chunk)
+{
+  chunk->next = NULL;
+  if (log_queue_tail)
+    log_queue_tail->next = chunk;
+  else
+    log_queue = chunk;
+  log_queue_tail = chunk;
+}
+
+/* hand the filled chunk of a log over to the writer thread and get an
+ * empty one. */
+static LogChunk *
+next_log_chunk (Log *log)
+{
+  LogChunk *chunk;
+
+  pthread_mutex_lock (&log_lock);
+  if (log->chunk)
+  {
+    queue_log_chunk (log->chunk);
+    pthread_cond_signal (&log_cond);
+  }
+  chunk = log_free;
+  if (chunk)
+    log_free = chunk->next;
+  else
+    chunk = malloc (sizeof (LogChunk));
+  if (chunk)
+    log_chunks++;
+  pthread_mutex_unlock (&log_lock);
+
+  log->chunk = chunk;
+  if (chunk)
+  {
+    chunk->log = log;
+    chunk->used = 0;
+  }
+
+  return chunk;
+}
+
+/* hand every log line formatted in this turn of the event loop over to
+ * the writer thread at once. */
+static void
+flush_logs (void)
+{
+  Log *log;
+
+  if (!dirty_logs)
+    return;
+
+  pthread_mutex_lock (&log_lock);
+  for (log = dirty_logs; log != NULL; log = log->dirty_next)
+  {
+    if (log->chunk && log->chunk->used)
+    {
+      queue_log_chunk (log->chunk);
+      log->chunk = NULL;
+    }
+    log->dirty = 0;
+  }
+  pthread_cond_signal (&log_cond);
+  pthread_mutex_unlock (&log_lock);
+
+  dirty_logs = NULL;
+}
+
+static void
+log_line (Task       *task,
+          const char *line,
+          size_t      len)
+{
+  Log      *log = task->log;
+  LogChunk *chunk = log->chunk;
+  size_t    id_len;
+
+  id_len = strlen (task->id);
+  if (!chunk || LOG_CHUNK - chunk->used < id_len + len + 3)
+    chunk = next_log_chunk (log);
+  if (!chunk)
+  {
+    MSG ("failed to allocate a log chunk: %s\n", STRERROR);
+    return;
+  }
+
+  memcpy (chunk->data + chunk->used, task->id, id_len);
+  chunk->data[chunk->used + id_len] = ':';
+  chunk->data[chunk->used + id_len + 1] = ' ';
+  memcpy (chunk->data + chunk->used + id_len + 2, line, len);
+  chunk->data[chunk->used + id_len + 2 + len] = '\n';
+  chunk->used += id_len + len + 3;
+
+  if (!log->dirty)
+  {
+    log->dirty = 1;
+    log->dirty_next = dirty_logs;
+    dirty_logs = log;
+  }
+}
+
+/* split the output of a task into lines, keeping a partial one until the
+ * rest of it is read, so that lines of tasks never interleave. */
+static void
+log_output (Task       *task,
+            const char *data,
+            size_t      size)
+{
+  const char *end = data + size;
+
+  while (data < end)
+  {
+    const char *nl;
+    size_t      len;
+
+    nl = memchr (data, '\n', end - data);
+    len = (nl ? nl : end) - data;
+
+    if (nl && !task->log_line_len && len <= LOG_LINE_MAX)
+    {
+      log_line (task, data, len);       // a whole line, no need to copy it
+      data = nl + 1;
+      continue;
+    }
+
+    if (len > LOG_LINE_MAX - task->log_line_len)
+      len = LOG_LINE_MAX - task->log_line_len;
+    memcpy (task->log_line + task->log_line_len, data, len);
+    task->log_line_len += len;
+    data += len;
+
+    if (data < end && *data == '\n')
+      data++;
+    else if (task->log_line_len < LOG_LINE_MAX)
+      continue;
+    log_line (task, task->log_line, task->log_line_len);
+    task->log_line_len = 0;
+  }
+}
+
+static void
+close_task_output (Task *task)
+{
+  task->log_paused = 0;
+
+  if (task->log_line_len)
+  {
+    log_line (task, task->log_line, task->log_line_len);
+    task->log_line_len = 0;
+  }
+
+  remove_watch (&task->log_watch);
+  close (task->log_watch.fd);
+  task->log_watch.fd = -1;
+}
+
+/* read once from the capture pipe of a task, returning -1 if there was
+ * nothing to read. */
+static ssize_t
+read_task_output (Task *task)
+{
+  static char buf[LOG_CHUNK];
+  ssize_t     n;
+
+  n = read (task->log_watch.fd, buf, sizeof (buf));
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return -1;
+
+  if (n <= 0)
+    close_task_output (task);
+  else
+    log_output (task, buf, n);
+
+  return n;
+}
+
+static void
+watch_task_output (Task *task,
+                   int   paused)
+{
+  task->log_paused = paused;
+  modify_watch (&task->log_watch, paused ? 0 : EPOLLIN);
+}
+
+/* while the writer thread lags too far behind, stop reading the output
+ * of tasks, so that they block on their own writes rather than procman
+ * on the log files. */
+static void
+handle_log (Watch       *watch,
+            unsigned int events)
+{
+  Task *task = TASK_OF_WATCH (watch, log_watch);
+  int   full;
+
+  pthread_mutex_lock (&log_lock);
+  full = log_chunks >= LOG_CHUNKS_MAX;
+  if (full)
+    log_waiting = 1;
+  pthread_mutex_unlock (&log_lock);
+
+  if (!full)
+  {
+    read_task_output (task);
+    return;
+  }
+
+  watch_task_output (task, 1);
+  task->log_paused_next = log_paused;
+  log_paused = task;
+}
+
+/* the writer thread has caught up, read the paused tasks again. */
+static void
+handle_log_writer (Watch       *watch,
+                   unsigned int events)
+{
+  unsigned long long count;
+  Task              *task;
+
+  if (read (watch->fd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+    MSG ("read\n");
+
+  for (task = log_paused; task != NULL; task = task->log_paused_next)
+    if (task->log_paused && task->log_watch.fd >= 0)
+      watch_task_output (task, 0);
+  log_paused = NULL;
+}
+
+/* read whatever is left in the capture pipe, and stop capturing it. */
+static void
+drain_task_output (Task *task)
+{
+  while (task->log_watch.fd >= 0 && read_task_output (task) > 0)
+    ;
+  if (task->log_watch.fd >= 0)
+    close_task_output (task);
+}
+
+/* give a task a capture pipe for its stdout and stderr. the output of a
+ * previous run, which may not have been read yet, is read first. */
+static void
+open_task_output (Task *task)
+{
+  int fds[2];
+
+  if (!log_combined && !log_dir)
+    return;
+
+  if (task->log_watch.fd >= 0)
+    drain_task_output (task);
+
+  if (!task->log)
+  {
+    task->log = log_combined;
+    if (!task->log)
+    {
+      size_t len = strlen (log_dir) + strlen (task->id) + 6;
+      char  *path = malloc (len);       // the writer thread holds it
+
+      task->log = calloc (1, sizeof (Log));
+      if (!task->log || !path)
+      {
+        MSG ("failed to allocate a log for program '%s': %s\n", task->id, STRERROR);
+        free (path);
+        free (task->log);
+        task->log = NULL;
+        return;
+      }
+      snprintf (path, len, "%s/%s.log", log_dir, task->id);
+      task->log->path = path;
+      task->log->fd = -1;
+    }
+  }
+  if (!task->log_line)
+    task->log_line = malloc (LOG_LINE_MAX);
+
+  if (!task->log_line || pipe2 (fds, O_CLOEXEC))
+  {
+    MSG ("failed to capture the output of program '%s': %s\n", task->id, STRERROR);
+    return;
+  }
+  fcntl (fds[0], F_SETFL, O_NONBLOCK);
+  if (add_watch (&task->log_watch, fds[0], EPOLLIN, handle_log))
+  {
+    close (fds[0]);
+    close (fds[1]);
+    task->log_watch.fd = -1;
+    return;
+  }
+  task->log_fd = fds[1];
+}
+
+/* open a log for appending, once. */
+static int
+open_log (Log *log)
+{
+  struct stat st;
+
+  if (log->fd < 0 && !log->broken)
+  {
+    log->fd = open (log->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log->fd < 0)
+    {
+      MSG ("failed to open log '%s': %s\n", log->path, STRERROR);
+      log->broken = 1;
+    }
+    log->size = log->fd >= 0 && !fstat (log->fd, &st) ? st.st_size : 0;
+  }
+
+  return log->fd >= 0 ? 0 : -1;
+}
+
+/* move a log which would grow too large out of the way, to 'path.1',
+ * and start a new one. */
+static void
+rotate_log (Log *log)
+{
+  char old[4096];
+
+  close (log->fd);
+  log->fd = -1;
+
+  snprintf (old, sizeof (old), "%s.1", log->path);
+  if (rename (log->path, old))
+    MSG ("failed to rotate log '%s': %s\n", log->path, STRERROR);
+  open_log (log);
+  log->size = 0;                        // even if it could not be renamed
+}
+
+static void
+write_log (Log          *log,
+           struct iovec *iov,
+           int           n)
+{
+  ssize_t len;
+
+  while (n > 0)
+  {
+    len = writev (log->fd, iov, n);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      MSG ("failed to write log '%s': %s\n", log->path, STRERROR);
+      return;
+    }
+    log->size += len;
+
+    for (; n > 0 && len >= iov->iov_len; iov++, n--)
+      len -= iov->iov_len;
+    if (n > 0)
+    {
+      iov->iov_base = (char *) iov->iov_base + len;
+      iov->iov_len -= len;
+    }
+  }
+}
+
+/* write a batch of chunks, with one writev() for each run of chunks of
+ * the same log. a log is rotated at the last line which fits in it. */
+static void
+write_log_chunks (LogChunk *chunk)
+{
+  struct iovec iov[LOG_IOV];
+  size_t       off = 0;                 // bytes of 'chunk' written already
+
+  while (chunk)
+  {
+    Log   *log = chunk->log;
+    size_t len = 0;
+    int    n = 0;
+
+    while (chunk && chunk->log == log && n < LOG_IOV && !open_log (log))
+    {
+      char  *data = chunk->data + off;
+      size_t part = chunk->used - off;
+
+      if (log_rotate && log->size + len + part > log_rotate)
+      {
+        size_t room = log_rotate > log->size + len ? log_rotate - log->size - len : 0;
+        char  *end = memrchr (data, '\n', room);
+
+        if (!end && !log->size && !len)
+          end = memchr (data, '\n', part);   // a line longer than a whole log
+        if (!end)
+        {
+          if (n)
+            break;                      // write what fits first
+          rotate_log (log);
+          continue;
+        }
+        part = end + 1 - data;
+      }
+
+      iov[n].iov_base = data;
+      iov[n].iov_len = part;
+      n++;
+      len += part;
+      off += part;
+      if (off < chunk->used)
+        break;
+      chunk = chunk->next;
+      off = 0;
+    }
+
+    if (n)
+      write_log (log, iov, n);
+    else if (log->fd < 0)               // drop the lines of a broken log
+      for (off = 0; chunk && chunk->log == log; chunk = chunk->next)
+        ;
+  }
+}
+
+static void *
+run_log_writer (void *data)
+{
+  LogChunk *batch;
+  LogChunk *chunk;
+
+  pthread_mutex_lock (&log_lock);
+  for (;;)
+  {
+    while (!log_queue && !log_stopping)
+      pthread_cond_wait (&log_cond, &log_lock);
+
+    batch = log_queue;
+    log_queue = log_queue_tail = NULL;
+    if (!batch)
+      break;
+
+    pthread_mutex_unlock (&log_lock);
+    write_log_chunks (batch);
+    pthread_mutex_lock (&log_lock);
+
+    while (batch)
+    {
+      chunk = batch;
+      batch = chunk->next;
+      chunk->next = log_free;
+      log_free = chunk;
+      log_chunks--;
+    }
+
+    if (log_waiting && log_chunks < LOG_CHUNKS_MAX / 2)
+    {
+      unsigned long long one = 1;
+
+      log_waiting = 0;
+      if (write (log_efd, &one, sizeof (one)) < 0)
+        MSG ("failed to wake up the event loop: %s\n", STRERROR);
+    }
+  }
+  pthread_mutex_unlock (&log_lock);
+
+  return NULL;
+}
+
+static int
+start_logs (const char *path)
+{
+  if (path)
+  {
+    log_combined = calloc (1, sizeof (Log));
+    if (!log_combined)
+      return -1;
+    log_combined->path = path;
+    log_combined->fd = -1;
+  }
+
+  log_efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (log_efd < 0 || add_watch (&log_watch, log_efd, EPOLLIN, handle_log_writer))
+    return -1;
+
+  errno = pthread_create (&log_thread, NULL, run_log_writer, NULL);
+
+  return errno ? -1 : 0;
+}
+
+/* write out the remaining output of every task and stop the writer. */
+static void
+stop_logs (void)
+{
+  TaskChunk *chunk;
+  Task      *task;
+
+  if (!log_combined && !log_dir)
+    return;
+
+  FOR_EACH_TASK (chunk, task)
+    if (task->log_watch.fd >= 0)
+      drain_task_output (task);
+  flush_logs ();
+
+  pthread_mutex_lock (&log_lock);
+  log_stopping = 1;
+  pthread_cond_signal (&log_cond);
+  pthread_mutex_unlock (&log_lock);
+  pthread_join (log_thread, NULL);
+}
+
+static void restart_task (Task *task);
+static void start_next_stage (void);
+static void handle_exit (Watch *watch, unsigned int events);
+static void start_reload_batch (void);
+static void listen_task (Task *task);
+static void stop_reloaded_task (Task *task);
+static void stop_late_task (Task *task);
+static void close_listener (Task *task);
+
+static void
+queue_start (Task *task)
+{
+  task->queue_next = NULL;
+  if (start_queue_tail)
+    start_queue_tail->queue_next = task;
+  else
+    start_queue = task;
+  start_queue_tail = task;
+}
+
+/* the first start of a task has succeeded or failed: queue the tasks
+ * which depend on it once all of their dependencies have settled. */
+static void
+settle_start (Task *task,
+              int   ok)
+{
+  unsigned int i;
+
+  if (task->started)
+    return;
+  task->started = 1;
+  task->start_ok = ok;
+
+  if (--n_unstarted == 0 && verbose)
+    MSG ("all tasks started in %lld ms\n", monotonic_ms () - startup_begin);
+
+  for (i = 0; i < task->n_dependents; i++)
+  {
+    Task *dep = task->dependents[i].task;
+
+    if (!ok && task->dependents[i].required)
+      dep->dep_failed = 1;
+    if (--dep->waiting == 0)
+      queue_start (dep);
+  }
+}
+
+/* the task has been executed, or failed to: stop watching its readiness
+ * pipe and let its dependents and its startup stage go on. */
+static void
+finish_start (Task *task)
+{
+  int     err;
+  ssize_t len;
+
+  len = read (task->ready_watch.fd, &err, sizeof (err));
+  if (len == sizeof (err))
+    MSG ("failed to execute command '%s': %s\n", task->command, strerror (err));
+
+  remove_watch (&task->ready_watch);
+  close (task->ready_watch.fd);
+  task->ready_watch.fd = -1;
+
+  if (task->state == TASK_STARTING)
+    task->state = TASK_RUNNING;
+  settle_start (task, len != sizeof (err));
+
+  if (task->staged)
+  {
+    task->staged = 0;
+    if (--stage_pending == 0)
+      start_next_stage ();
+  }
+}
+
+static void
+handle_ready (Watch       *watch,
+              unsigned int events)
+{
+  if (watch->fd < 0)                    // already finished by the reaper
+    return;
+
+  finish_start (TASK_OF_WATCH (watch, ready_watch));
+}
+
+/* watch the exit of a spawned child by a pidfd, which names the process
+ * itself rather than its pid. a child which cannot be watched would never
+ * be reaped, so it is killed and counted as failed to spawn. */
+static int
+watch_exit (Task *task,
+            pid_t pid,
+            int   ep)
+{
+  int fd;
+
+  fd = syscall (SYS_pidfd_open, pid, 0);
+  if (fd >= 0 && !(ep < 0 ? add_watch (&task->exit_watch, fd, EPOLLIN, handle_exit) :
+                   add_watch_to (ep, &task->exit_watch, fd, EPOLLIN, handle_exit)))
+    return 0;
+
+  MSG ("failed to watch program '%s': %s\n", task->id, STRERROR);
+  if (fd >= 0)
+    close (fd);
+  task->exit_watch.fd = -1;
+  kill (pid, SIGKILL);
+  waitpid (pid, NULL, 0);
+
+  return -1;
+}
+
+/* execute a prepared task, and watch its exit in the epoll 'ep' of a
+ * shard, or in the event loop if it is -1. */
+static pid_t
+exec_task (Task *task,
+           int   ep,
+           int  *ready_fd)
+{
+  pid_t pid;
+
+  *ready_fd = -1;
+  if (spawn_backend == SPAWN_POSIX && task->listen_watch.fd < 0)  // a socket needs fd 3
+    pid = spawn_task_posix (task);
+  else
+    pid = spawn_task_fork (task, ready_fd);
+  if (pid > 0 && use_pidfd && watch_exit (task, pid, ep))
+    pid = 0;
+
+  return pid;
+}
+
+/* give the slot of a removed task, whose process is gone, back for a
+ * later reload to reuse. its strings go with the next compaction. */
+static void
+reclaim_task (Task *task)
+{
+  Task **slot;
+
+  if (task->log_watch.fd >= 0)
+    drain_task_output (task);
+  for (slot = &log_paused; *slot != NULL; slot = &(*slot)->log_paused_next)
+    if (*slot == task)
+    {
+      *slot = task->log_paused_next;
+      break;
+    }
+  free (task->log_line);
+  task->log_line = NULL;
+
+  if (task->cgroup_made && unlinkat (cgroup_root_fd, task->id, AT_REMOVEDIR))
+    MSG ("failed to remove the cgroup of program '%s': %s\n", task->id, STRERROR);
+  task->cgroup_made = 0;
+
+  task->free_next = free_tasks;
+  free_tasks = task;
+}
+
+/* an old process stopped by a reload is gone, the reload may now start
+ * the new definitions once all of them are. */
+static void
+reload_stopped (Task *task)
+{
+  task->reload &= ~RELOAD_STOPPING;
+  if (task->removed)
+    reclaim_task (task);
+  if (--reload_stopping)
+    return;
+  reload_stops = NULL;
+  if (running)
+    start_reload_batch ();
+}
+
+/* a task has been executed, or failed to be. */
+static void
+finish_spawn (Task *task,
+              pid_t pid,
+              int   ready_fd)
+{
+  close_task_pipes (task);
+  if (task->cgroup_fd >= 0)
+    close (task->cgroup_fd);
+  task->cgroup_fd = -1;
+
+  if (task->reload & RELOAD_STOPPING)
+  {
+    /* unloaded by a reload while a shard spawned it */
+    close_listener (task);
+    if (ready_fd >= 0)
+      close (ready_fd);
+    if (pid > 0)
+    {
+      task->spawns++;
+      set_task_pid (task, pid);
+      stop_reloaded_task (task);
+    }
+    else
+      reload_stopped (task);
+    return;
+  }
+
+  if (pid > 0)
+  {
+    task->spawns++;
+    task->started_at = monotonic_ms ();
+    if (task->exited_at)
+      observe (&respawn_latency, monotonic_us () - task->exited_at);
+  }
+
+  set_task_pid (task, pid);
+  if (pid > 0 && shutdown_signo)        // spawned by a shard as the shutdown began
+    stop_late_task (task);
+
+  if (ready_fd >= 0)
+  {
+    if (pid > 0 && !add_watch (&task->ready_watch, ready_fd, EPOLLIN, handle_ready))
+      task->state = TASK_STARTING;
+    else
+      close (ready_fd);
+  }
+
+  if (task->state != TASK_STARTING)
+    settle_start (task, pid > 0);
+  if (pid <= 0 && running && (task->action == ACTION_RESPAWN || task->listen))
+    restart_task (task);                // a socket activated one listens again
+}
+
+/* the event loop never waits for an event from the shards, so one may
+ * not be dropped for the lack of memory. */
+static ShardEvent *
+alloc_shard_event (void)
+{
+  ShardEvent *event;
+
+  pthread_mutex_lock (&shard_lock);
+  event = shard_free;
+  if (event)
+    shard_free = event->next;
+  pthread_mutex_unlock (&shard_lock);
+
+  while (!event && !(event = malloc (sizeof (ShardEvent))))
+    usleep (10000);
+
+  return event;
+}
+
+static void
+post_shard_event (ShardEvent *event)
+{
+  unsigned long long one = 1;
+  int                wake;
+
+  event->next = NULL;
+  pthread_mutex_lock (&shard_lock);
+  wake = !shard_events;                 // else the loop has yet to take them
+  if (shard_events_tail)
+    shard_events_tail->next = event;
+  else
+    shard_events = event;
+  shard_events_tail = event;
+  pthread_mutex_unlock (&shard_lock);
+
+  if (wake && write (shard_efd, &one, sizeof (one)) < 0)
+    MSG ("failed to wake up the event loop: %s\n", STRERROR);
+}
+
+/* collect the exit of a readable pidfd in a shard. the process is left a
+ * zombie, reaped by the event loop as it applies the exit, so its pid is
+ * not reused while the loop may still signal it. */
+static void
+reap_in_shard (Shard *shard,
+               Watch *watch)
+{
+  ShardEvent *event;
+  siginfo_t   info;
+
+  event = alloc_shard_event ();
+  memset (&info, 0x00, sizeof (info));
+  memset (&event->ru, 0x00, sizeof (event->ru));
+  event->pidfd = watch->fd;
+  if (syscall (SYS_waitid, P_PIDFD, watch->fd, &info, WEXITED | WNOHANG | WNOWAIT, &event->ru) < 0)
+  {
+    MSG ("failed to reap a program: %s\n", STRERROR);
+    event->status = -1;
+  }
+  else if (!info.si_pid)
+  {
+    /* not exited after all */
+    pthread_mutex_lock (&shard_lock);
+    event->next = shard_free;
+    shard_free = event;
+    pthread_mutex_unlock (&shard_lock);
+    return;
+  }
+  else if (info.si_code == CLD_EXITED)
+    event->status = (info.si_status & 0xff) << 8;
+  else
+    event->status = info.si_status | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+
+  epoll_ctl (shard->epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+  watch->fd = -1;                       // closed by the event loop
+
+  event->task = TASK_OF_WATCH (watch, exit_watch);
+  event->exited = 1;
+  post_shard_event (event);
+}
+
+static void *
+run_shard (void *data)
+{
+  Shard             *shard = data;
+  struct epoll_event events[EVENT_BATCH];
+  unsigned long long count;
+  ShardEvent        *event;
+  Task              *batch;
+  Task              *task;
+  int                wake;
+  int                n;
+  int                i;
+
+  for (;;)
+  {
+    n = epoll_wait (shard->epfd, events, EVENT_BATCH, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      MSG ("epoll_wait: %s\n", STRERROR);
+      break;
+    }
+
+    wake = 0;
+    for (i = 0; i < n; i++)
+      if (events[i].data.ptr == &shard->wake_watch)
+        wake = 1;
+      else
+        reap_in_shard (shard, events[i].data.ptr);
+    if (!wake)
+      continue;
+
+    if (read (shard->wake_watch.fd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+      MSG ("read\n");
+
+    pthread_mutex_lock (&shard->lock);
+    batch = shard->queue;
+    shard->queue = shard->queue_tail = NULL;
+    pthread_mutex_unlock (&shard->lock);
+
+    while (batch)
+    {
+      task = batch;
+      batch = task->spawn_next;
+
+      event = alloc_shard_event ();
+      event->task = task;
+      event->exited = 0;
+      event->pid = exec_task (task, shard->epfd, &event->ready_fd);
+      post_shard_event (event);
+    }
+  }
+
+  return NULL;
+}
+
+/* hand a prepared task to its shard to be spawned. */
+static void
+queue_spawn (Task *task)
+{
+  Shard             *shard = &shards[task->index % n_shards];
+  unsigned long long one = 1;
+  int                wake;
+
+  task->spawning = 1;
+  task->spawn_next = NULL;
+  if (task->state == TASK_BACKOFF)
+    task->state = TASK_IDLE;            // its timer has fired
+  n_spawning++;
+
+  pthread_mutex_lock (&shard->lock);
+  wake = !shard->queue;                 // else the shard has yet to take them
+  if (shard->queue_tail)
+    shard->queue_tail->spawn_next = task;
+  else
+    shard->queue = task;
+  shard->queue_tail = task;
+  pthread_mutex_unlock (&shard->lock);
+
+  if (wake && write (shard->wake_watch.fd, &one, sizeof (one)) < 0)
+    MSG ("failed to wake up shard %u: %s\n", (unsigned int) (shard - shards), STRERROR);
+}
+
+static void
+spawn_task (Task *task)
+{
+  pid_t pid;
+  int   ready_fd;
+
+  if (0) MSG ("spawn program '%s'...\n", task->id);
+
+  if (task->listen && !task->activated)
+  {
+    listen_task (task);
+    return;
+  }
+  task->activated = 0;
+
+  if (task->piped)
+    open_task_pipes (task);
+  open_task_output (task);
+  task->cgroup_fd = open_task_cgroup (task);
+
+  if (n_shards)
+  {
+    queue_spawn (task);
+    return;
+  }
+
+  pid = exec_task (task, -1, &ready_fd);
+  finish_spawn (task, pid, ready_fd);
+}
+
+/* cpu ticks used by a process so far, from the utime and stime fields of
+ * /proc/PID/stat, or -1. */
+static long long
+read_process_cpu (pid_t pid)
+{
+  char               path[32];
+  char               buf[512];
+  unsigned long long utime;
+  unsigned long long stime;
+  char              *s;
+  ssize_t            len;
+  int                fd;
+  int                i;
+
+  sprintf (path, "/proc/%d/stat", (int) pid);
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  len = read (fd, buf, sizeof (buf) - 1);
+  close (fd);
+  if (len <= 0)
+    return -1;
+  buf[len] = '\0';
+
+  /* the command may hold spaces and parens, the fields follow the last ')' */
+  s = strrchr (buf, ')');
+  for (i = 0; s && i < 12; i++)
+    s = strchr (s + 1, ' ');
+  if (!s || sscanf (s, "%llu %llu", &utime, &stime) != 2)
+    return -1;
+
+  return utime + stime;
+}
+
+/* stop the activated tasks which have used no cpu for their idle timeout,
+ * with no connection queued. they listen again once they have exited. */
+static void
+handle_idle_timer (Watch       *watch,
+                   unsigned int events)
+{
+  unsigned long long expirations;
+  struct pollfd      pfd;
+  TaskChunk         *chunk;
+  Task              *task;
+  unsigned int       i;
+  long long          now;
+  long long          cpu;
+
+  if (read (watch->fd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN)
+    MSG ("read\n");
+  if (!running)
+    return;
+
+  now = monotonic_ms ();
+  FOR_EACH_LIVE_TASK (chunk, i, task)
+  {
+    if (!task->idle_timeout || task->listen_watch.fd < 0)
+      continue;
+
+    cpu = read_process_cpu (task->pid);
+    pfd.fd = task->listen_watch.fd;
+    pfd.events = POLLIN;
+    if (cpu != task->idle_cpu || poll (&pfd, 1, 0) > 0)
+    {
+      task->idle_cpu = cpu;
+      task->active_at = now;
+    }
+    else if (now - task->active_at >= task->idle_timeout)
+    {
+      if (verbose)
+        MSG ("program '%s' idle for %lld ms, stopped\n", task->id, now - task->active_at);
+      kill (task->pid, SIGTERM);
+      task->active_at = now;            // not signalled again right away
+    }
+  }
+}
+
+/* check the activated tasks for idleness every IDLE_CHECK ms, from the
+ * first activation of a task with an idle timeout on. */
+static void
+start_idle_checks (void)
+{
+  struct itimerspec its;
+
+  idle_tfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (idle_tfd < 0)
+  {
+    MSG ("failed to create the idle timer: %s\n", STRERROR);
+    return;
+  }
+
+  memset (&its, 0x00, sizeof (its));
+  its.it_value.tv_sec = its.it_interval.tv_sec = IDLE_CHECK / 1000;
+  its.it_value.tv_nsec = its.it_interval.tv_nsec = (IDLE_CHECK % 1000) * 1000000;
+  if (timerfd_settime (idle_tfd, 0, &its, NULL) ||
+      add_watch (&idle_watch, idle_tfd, EPOLLIN, handle_idle_timer))
+  {
+    MSG ("failed to start the idle timer: %s\n", STRERROR);
+    close (idle_tfd);
+    idle_tfd = -1;
+  }
+}
+
+/* a connection to the socket of a parked task spawns it. the socket stays
+ * in the event loop with no events while the task runs, and the task
+ * accepts the connection itself. */
+static void
+handle_listen (Watch       *watch,
+               unsigned int events)
+{
+  Task *task = TASK_OF_WATCH (watch, listen_watch);
+
+  if (task->state != TASK_LISTENING)
+    return;
+
+  if (0) MSG ("program '%s' activated\n", task->id);
+
+  modify_watch (watch, 0);
+  n_listening--;
+  task->state = TASK_IDLE;
+  task->activated = 1;
+  task->idle_cpu = -1;
+  task->active_at = monotonic_ms ();
+  if (task->idle_timeout && idle_tfd < 0)
+    start_idle_checks ();
+  spawn_task (task);
+}
+
+/* park a socket activated task until a connection arrives, binding its
+ * socket the first time. being ready to accept counts as started. */
+static void
+listen_task (Task *task)
+{
+  int fd;
+
+  if (task->listen_watch.fd < 0)
+  {
+    fd = open_listener (task->listen);
+    if (fd < 0 || add_watch (&task->listen_watch, fd, EPOLLIN, handle_listen))
+    {
+      MSG ("failed to listen on '%s' for program '%s': %s\n", task->listen, task->id, STRERROR);
+      if (fd >= 0)
+        close (fd);
+      task->listen_watch.fd = -1;
+      task->state = TASK_FAILED;
+      settle_start (task, 0);
+      return;
+    }
+  }
+  else
+    modify_watch (&task->listen_watch, EPOLLIN);
+
+  task->state = TASK_LISTENING;
+  n_listening++;
+  settle_start (task, 1);
+}
+
+/* stop listening for a task, which is unloaded or shut down. the path of
+ * a unix socket is the one it was bound to, as a reload may have changed
+ * the address of the task since. */
+static void
+close_listener (Task *task)
+{
+  if (task->listen_watch.fd < 0)
+    return;
+
+  if (task->state == TASK_LISTENING)
+  {
+    n_listening--;
+    task->state = TASK_IDLE;
+  }
+  remove_watch (&task->listen_watch);
+  unlink_bound_socket (task->listen_watch.fd);
+  close (task->listen_watch.fd);
+  task->listen_watch.fd = -1;
+}
+
+static void
+close_listeners (void)
+{
+  TaskChunk *chunk;
+  Task      *task;
+
+  FOR_EACH_TASK (chunk, task)
+    close_listener (task);
+}
+
+static void
+swap_timers (unsigned int i,
+             unsigned int j)
+{
+  Task *task;
+
+  task = timer_heap[i];
+  timer_heap[i] = timer_heap[j];
+  timer_heap[j] = task;
+  timer_heap[i]->heap_index = i;
+  timer_heap[j]->heap_index = j;
+}
+
+static unsigned int
+sift_timer_up (unsigned int i)
+{
+  while (i > 0 && timer_heap[(i - 1) / 2]->restart_at > timer_heap[i]->restart_at)
+  {
+    swap_timers (i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+
+  return i;
+}
+
+static void
+sift_timer_down (unsigned int i)
+{
+  for (;;)
+  {
+    unsigned int child = i * 2 + 1;
+
+    if (child >= timer_heap_count)
+      break;
+    if (child + 1 < timer_heap_count &&
+        timer_heap[child + 1]->restart_at < timer_heap[child]->restart_at)
+      child++;
+    if (timer_heap[i]->restart_at <= timer_heap[child]->restart_at)
+      break;
+    swap_timers (i, child);
+    i = child;
+  }
+}
+
+/* arm the timer fd for the earliest delayed respawn, or disarm it. */
+static void
+arm_timer (void)
+{
+  struct itimerspec its;
+
+  memset (&its, 0x00, sizeof (its));
+  if (timer_heap_count)
+  {
+    long long at = timer_heap[0]->restart_at;
+
+    its.it_value.tv_sec = at / 1000;
+    its.it_value.tv_nsec = (at % 1000) * 1000000 + 1;
+  }
+
+  if (timerfd_settime (tfd, TFD_TIMER_ABSTIME, &its, NULL))
+    MSG ("failed to arm the respawn timer: %s\n", STRERROR);
+}
+
+static void
+push_timer (Task *task)
+{
+  unsigned int i;
+
+  if (timer_heap_count == timer_heap_size)
+  {
+    unsigned int size;
+    Task       **heap;
+
+    size = timer_heap_size ? timer_heap_size * 2 : HASH_SIZE_MIN;
+    heap = realloc (timer_heap, size * sizeof (Task *));
+    if (!heap)
+    {
+      MSG ("failed to delay program '%s': %s\n", task->id, STRERROR);
+      task->state = TASK_FAILED;
+      return;
+    }
+    timer_heap = heap;
+    timer_heap_size = size;
+  }
+
+  i = timer_heap_count++;
+  timer_heap[i] = task;
+  task->heap_index = i;
+  if (sift_timer_up (i) == 0)
+    arm_timer ();
+}
+
+/* take the timer at 'i' out of the heap. */
+static void
+delete_timer (unsigned int i)
+{
+  timer_heap_count--;
+  if (i == timer_heap_count)
+    return;
+
+  timer_heap[i] = timer_heap[timer_heap_count];
+  timer_heap[i]->heap_index = i;
+  sift_timer_down (sift_timer_up (i));
+}
+
+static Task *
+pop_timer (void)
+{
+  Task *task;
+
+  task = timer_heap[0];
+  delete_timer (0);
+
+  return task;
+}
+
+/* cancel the delayed respawn of a task. */
+static void
+remove_timer (Task *task)
+{
+  int first = task->heap_index == 0;
+
+  delete_timer (task->heap_index);
+  task->state = TASK_IDLE;
+  if (first)
+    arm_timer ();
+}
+
+/* respawn a task which has exited: right away the first time in its
+ * restart window, then with an exponentially growing delay, and not at
+ * all once it exceeded its restart limit. */
+static void
+restart_task (Task *task)
+{
+  long long    now;
+  unsigned int delay;
+  unsigned int i;
+
+  now = monotonic_ms ();
+  if (now - task->window_start >= task->window)
+  {
+    task->window_start = now;
+    task->restarts = 0;
+  }
+  task->restarts++;
+
+  if (task->max_restarts && task->restarts > task->max_restarts)
+  {
+    MSG ("program '%s' respawned too often, given up\n", task->id);
+    task->state = TASK_FAILED;
+    return;
+  }
+
+  delay = 0;
+  if (task->restarts > 1)
+  {
+    delay = task->backoff;
+    for (i = 2; i < task->restarts && delay < task->backoff_max; i++)
+      delay <<= 1;
+    if (delay > task->backoff_max)
+      delay = task->backoff_max;
+  }
+
+  if (!delay)
+  {
+    spawn_task (task);
+    return;
+  }
+
+  if (0) MSG ("respawn program '%s' in %u ms\n", task->id, delay);
+
+  task->state = TASK_BACKOFF;
+  task->restart_at = now + delay;
+  push_timer (task);
+}
+
+static void
+handle_timer (Watch       *watch,
+              unsigned int events)
+{
+  unsigned long long expirations;
+  long long          now;
+
+  if (read (watch->fd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN)
+    MSG ("read\n");
+
+  now = monotonic_ms ();
+  while (timer_heap_count && timer_heap[0]->restart_at <= now)
+  {
+    Task *task = pop_timer ();
+
+    if (running)
+      spawn_task (task);
+    else
+      task->state = TASK_IDLE;
+  }
+
+  arm_timer ();
+}
+
+/* [new] launch every task of the next order at once, moving on to the
+ * following order only once all of them have been executed. tasks with
+ * dependencies are started by those instead. */
+static void
+start_next_stage (void)
+{
+  while (stage_next && !stage_pending && running)
+  {
+    unsigned int order = stage_next->order;
+
+    for (; stage_next && stage_next->order == order && running; stage_next = stage_next->next)
+    {
+      if (stage_next->n_deps || stage_next->state == TASK_FAILED)
+        continue;
+
+      spawn_task (stage_next);
+      if (stage_next->state == TASK_STARTING)
+      {
+        stage_next->staged = 1;
+        stage_pending++;
+      }
+    }
+  }
+}
+
+/* start the tasks whose dependencies have all settled. */
+static void
+flush_start_queue (void)
+{
+  while (start_queue)
+  {
+    Task *task = start_queue;
+
+    start_queue = task->queue_next;
+    if (!start_queue)
+      start_queue_tail = NULL;
+
+    if (task->state == TASK_FAILED || !running)
+      continue;
+
+    if (task->dep_failed)
+    {
+      MSG ("required task of '%s' failed to start, not started\n", task->id);
+      task->state = TASK_FAILED;
+      close_task_pipes (task);          // its neighbours may have spawned
+      settle_start (task, 0);
+      continue;
+    }
+
+    spawn_task (task);
+  }
+}
+
+static void
+spawn_tasks (void)
+{
+  TaskChunk *chunk;
+  Task      *task;
+
+  startup_begin = monotonic_ms ();
+  n_unstarted = n_tasks;
+
+  /* tasks which will never start release their dependents right away */
+  FOR_EACH_TASK (chunk, task)
+    if (task->state == TASK_FAILED)
+      settle_start (task, 0);
+
+  stage_next = tasks;
+  stage_pending = 0;
+  start_next_stage ();
+  flush_start_queue ();
+}
+
+/* start the tasks of a reload once the old runs have exited, in stages
+ * like at startup. */
+static void
+start_reload_batch (void)
+{
+  Task *task;
+
+  startup_begin = monotonic_ms ();
+  for (task = reload_tasks; task != NULL; task = task->next)
+    n_unstarted++;
+  for (task = reload_tasks; task != NULL; task = task->next)
+    if (task->state == TASK_FAILED)
+      settle_start (task, 0);
+
+  stage_next = reload_tasks;
+  reload_tasks = NULL;
+  start_next_stage ();
+  flush_start_queue ();
+}
+
+/* find the task a config line defines, by the id it starts with. */
+static Task *
+lookup_line_task (const char *line)
+{
+  char   id[ID_MAX + 1];
+  size_t len;
+
+  len = strcspn (line, ":");
+  while (len > 0 && isspace (line[len - 1]))
+    len--;
+  if (len < ID_MIN || len > ID_MAX)
+    return NULL;
+  memcpy (id, line, len);
+  id[len] = '\0';
+
+  return lookup_task (id);
+}
+
+/* add a task to the ones touched by the current reload. */
+static void
+mark_dirty (Task *task)
+{
+  if (!task || (task->reload & RELOAD_DIRTY))
+    return;
+
+  task->reload |= RELOAD_DIRTY;
+  task->reload_next = NULL;
+  if (reload_dirty_tail)
+    reload_dirty_tail->reload_next = task;
+  else
+    reload_dirty = task;
+  reload_dirty_tail = task;
+  reload_dirty_count++;
+}
+
+/* make room for one more definition. */
+static Task *
+next_def (Task        **defs,
+          unsigned int  n_defs,
+          unsigned int *size)
+{
+  if (n_defs == *size)
+  {
+    unsigned int new_size = *size ? *size * 2 : HASH_SIZE_MIN;
+    Task        *new_defs = realloc (*defs, new_size * sizeof (Task));
+
+    if (!new_defs)
+      return NULL;
+    *defs = new_defs;
+    *size = new_size;
+  }
+
+  return &(*defs)[n_defs];
+}
+
+/* stop the run of a task which is redefined or removed, and unlink it
+ * from the tasks it was piped with. those are touched as well. */
+static void
+unload_task (Task *task)
+{
+  if (task->state == TASK_STARTING)
+    finish_start (task);
+  if (task->state == TASK_BACKOFF)
+    remove_timer (task);
+  if (!task->spawning)                  // else once its shard has spawned it
+    close_listener (task);              // bound again by its new definition
+  if (task->pid > 0 || task->spawning)
+  {
+    task->reload |= RELOAD_STOPPING;
+    reload_stopping++;
+    if (task->pid > 0)                  // else once its shard has spawned it
+      stop_reloaded_task (task);
+  }
+
+  if (!task->spawning)                  // its shard may still pass them on
+    close_task_pipes (task);
+  task->pipe_peer = task->pipe_from = task->pipe_to = NULL;
+  task->piped = task->pipes_open = task->stdin_open = 0;
+
+  if (task->reload & RELOAD_REMOVE)
+  {
+    unindex_task_id (task);
+    task->removed = 1;
+  }
+}
+
+/* give a task the definition of its new line, keeping what it has run
+ * so far. */
+static void
+define_task (Task *task,
+             Task *def)
+{
+  if (task->memory_max != def->memory_max || task->cpu_max != def->cpu_max)
+    task->cgroup_made = 0;              // so that the limits are written again
+
+  task->action = def->action;
+  task->order = def->order;
+  task->line_nr = def->line_nr;
+  task->line = def->line;
+  task->line_hash = def->line_hash;
+  task->command = def->command;
+  task->argv = def->argv;
+  strcpy (task->pipe_id, def->pipe_id);
+  strcpy (task->pipe_from_id, def->pipe_from_id);
+  task->pipe_size = def->pipe_size;
+  task->packet = def->packet;
+  task->tap = def->tap;
+  task->after = def->after;
+  task->requires = def->requires;
+  task->max_restarts = def->max_restarts;
+  task->window = def->window;
+  task->backoff = def->backoff;
+  task->backoff_max = def->backoff_max;
+  task->stop_timeout = def->stop_timeout;
+  task->listen = def->listen;
+  task->idle_timeout = def->idle_timeout;
+  task->activated = 0;
+  task->memory_max = def->memory_max;
+  task->cpu_max = def->cpu_max;
+
+  task->state = task->pid > 0 ? TASK_RUNNING : TASK_IDLE;
+  task->dependents = NULL;
+  task->n_dependents = task->n_deps = task->waiting = 0;
+  task->dep_failed = task->started = task->start_ok = 0;
+  task->restarts = 0;
+  task->window_start = 0;
+}
+
+static int
+compare_task_line (const void *a,
+                   const void *b)
+{
+  const Task *ta = *(const Task **) a;
+  const Task *tb = *(const Task **) b;
+
+  return ta->line_nr < tb->line_nr ? -1 : ta->line_nr > tb->line_nr;
+}
+
+/* forget the tasks touched by a reload, but the processes it stops. */
+static void
+finish_reload (void)
+{
+  Task *task;
+
+  for (task = reload_dirty; task != NULL; task = task->reload_next)
+  {
+    task->reload &= RELOAD_STOPPING;
+    if (task->removed && !task->reload)   // else once its process is gone
+      reclaim_task (task);
+  }
+  reload_dirty = reload_dirty_tail = NULL;
+  reload_dirty_count = 0;
+}
+
+/* move a string, if any, to the current string pool. */
+static int
+pool_move (const char **str)
+{
+  const char *copy;
+
+  if (!*str)
+    return 0;
+  copy = pool_strdup (*str);
+  if (!copy)
+    return -1;
+  *str = copy;
+
+  return 0;
+}
+
+/* move the strings of a task to the current string pool. every pointer
+ * it has is valid whether it is moved or not, so it may fail half way. */
+static int
+move_task_strings (Task *task)
+{
+  char       **argv;
+  char        *p;
+  size_t       len = 0;
+  size_t       offset = 0;
+  int          in_line;
+  unsigned int n;
+  unsigned int i;
+
+  /* the command is a part of the line when it comes from the cache */
+  in_line = task->command >= task->line && task->command <= task->line + strlen (task->line);
+  if (in_line)
+    offset = task->command - task->line;
+  if (pool_move (&task->line))
+    return -1;
+  if (in_line)
+    task->command = task->line + offset;
+  else if (pool_move (&task->command))
+    return -1;
+
+  for (n = 0; task->argv[n]; n++)
+    len += strlen (task->argv[n]) + 1;
+  argv = pool_alloc ((n + 1) * sizeof (char *) + len, sizeof (char *));
+  if (!argv)
+    return -1;
+  p = (char *) (argv + n + 1);
+  for (i = 0; i < n; i++)
+  {
+    argv[i] = p;
+    p = stpcpy (p, task->argv[i]) + 1;
+  }
+  argv[n] = NULL;
+  task->argv = argv;
+
+  return pool_move (&task->after) || pool_move (&task->requires) ||
+         pool_move (&task->tap) || pool_move (&task->listen);
+}
+
+/* copy the strings of the live tasks into a new pool, and free the old
+ * one with the lines every reload has replaced or removed. it runs once
+ * every task has started and no shard is spawning, as the shards read the
+ * commands, and the dependents are only walked by the start of a task. */
+static void
+compact_string_pool (void)
+{
+  StringChunk *old = string_chunks;
+  StringChunk *next;
+  TaskChunk   *chunk;
+  Task        *task;
+
+  string_chunks = NULL;
+  pool_used = 0;
+  FOR_EACH_TASK (chunk, task)
+  {
+    task->dependents = NULL;
+    task->n_dependents = 0;
+    if (task->removed)
+    {
+      task->line = task->command = NULL;
+      task->argv = NULL;
+      task->after = task->requires = task->tap = task->listen = NULL;
+    }
+    else if (move_task_strings (task))
+    {
+      MSG ("failed to compact the string pool: %s\n", STRERROR);
+      for (next = string_chunks; next && next->next; next = next->next)
+        ;
+      if (next)
+        next->next = old;               // some tasks still point to it
+      else
+        string_chunks = old;
+      pool_kept = pool_used;
+      return;
+    }
+  }
+
+  for (; old != NULL; old = next)
+  {
+    next = old->next;
+    free (old);
+  }
+  pool_kept = pool_used;
+}
+
+/* [new] reload the config on SIGHUP. the tasks whose line changed, and
+ * the tasks piped with them, are stopped and started again, the tasks
+ * whose line is gone are stopped and new ones are started. the others
+ * keep running untouched: past reading the file, the work follows the
+ * number of touched tasks rather than the size of the config. */
+static void
+reload_config (void)
+{
+  TaskChunk   *chunk;
+  Task        *task;
+  Task        *def;
+  Task        *defs = NULL;
+  Task       **batch;
+  ConfigFile   config;
+  char        *line;
+  unsigned int n_defs = 0;
+  unsigned int defs_size = 0;
+  unsigned int n_seen = 0;
+  unsigned int n_added = 0;
+  unsigned int n_changed = 0;
+  unsigned int n_removed = 0;
+  unsigned int n;
+  unsigned int i;
+  long long    begin;
+
+  begin = monotonic_ms ();
+  if (open_config (&config, config_path))
+  {
+    MSG ("failed to reload config file '%s': %s\n", config_path, STRERROR);
+    return;
+  }
+
+  /* new and changed lines are parsed, unchanged ones are only seen. a
+   * line which fails to parse leaves its task as it was. */
+  config_generation++;
+  while ((line = next_config_line (&config)) != NULL)
+  {
+    task = lookup_line_task (line);
+    if (task)
+    {
+      if (task->generation == config_generation)
+      {
+        MSG ("duplicate id '%s' in line %d, ignored\n", task->id, config.line_nr);
+        continue;
+      }
+      task->generation = config_generation;
+      task->line_nr = config.line_nr;
+      n_seen++;
+      if (task->line_hash == hash_id (line) && !strcmp (task->line, line))
+        continue;
+    }
+
+    def = next_def (&defs, n_defs, &defs_size);
+    if (!def)
+      goto no_memory;
+    if (parse_task_line (line, config.line_nr, config.indent, def))
+      continue;
+    n_defs++;
+
+    if (task)
+    {
+      mark_dirty (task);
+      task->reload |= RELOAD_DEFINED;
+      n_changed++;
+    }
+    else
+      n_added++;
+  }
+  close_config (&config);
+  config.data = NULL;
+
+  /* the scan for removed tasks is skipped when every task was seen */
+  if (n_seen < id_table_count)
+    FOR_EACH_TASK (chunk, task)
+      if (!task->removed && task->generation != config_generation)
+      {
+        mark_dirty (task);
+        task->reload |= RELOAD_REMOVE;
+        n_removed++;
+      }
+
+  /* the tasks piped with a touched one, by the old links or the new
+   * lines, are touched too and redefined by their unchanged lines */
+  for (i = 0; i < n_defs; i++)
+  {
+    if (defs[i].pipe_id[0] != '\0')
+      mark_dirty (lookup_task (defs[i].pipe_id));
+    if (defs[i].pipe_from_id[0] != '\0')
+      mark_dirty (lookup_task (defs[i].pipe_from_id));
+  }
+  for (task = reload_dirty; task != NULL; task = task->reload_next)
+  {
+    char *copy;
+
+    mark_dirty (task->pipe_peer);
+    mark_dirty (task->pipe_from);
+    mark_dirty (task->pipe_to);
+    if (task->reload & (RELOAD_DEFINED | RELOAD_REMOVE))
+      continue;
+
+    def = next_def (&defs, n_defs, &defs_size);
+    copy = strdup (task->line);
+    if (!def || !copy)
+    {
+      free (copy);
+      goto no_memory;
+    }
+    if (parse_task_line (copy, task->line_nr, 0, def))
+      task->reload |= RELOAD_REMOVE;
+    else
+    {
+      task->reload |= RELOAD_DEFINED;
+      n_defs++;
+    }
+    free (copy);
+  }
+
+  if (!reload_dirty && !n_defs)
+  {
+    free (defs);
+    return;
+  }
+  batch = malloc ((reload_dirty_count + n_defs) * sizeof (Task *));
+  if (!batch)
+    goto no_memory;
+
+  /* nothing can fail from here on */
+  for (task = reload_dirty; task != NULL; task = task->reload_next)
+    unload_task (task);
+
+  for (i = 0; i < n_defs; i++)
+  {
+    task = lookup_task (defs[i].id);
+    if (!task)
+    {
+      task = append_task (&defs[i]);
+      if (!task)
+        continue;
+      mark_dirty (task);
+    }
+    else if ((task->reload & RELOAD_DIRTY) && !(task->reload & RELOAD_APPLIED))
+      define_task (task, &defs[i]);
+    else
+    {
+      MSG ("duplicate id '%s' in line %d, ignored\n", defs[i].id, defs[i].line_nr);
+      continue;
+    }
+    task->reload |= RELOAD_APPLIED;
+  }
+  free (defs);
+
+  /* link the pipes in the order of the lines, as at startup */
+  n = 0;
+  for (task = reload_dirty; task != NULL; task = task->reload_next)
+    if (task->reload & RELOAD_APPLIED)
+      batch[n++] = task;
+  qsort (batch, n, sizeof (Task *), compare_task_line);
+  for (i = 0; i < n; i++)
+  {
+    Task *peer;
+    Task *from;
+
+    if (find_pipe_tasks (batch[i], &peer, &from))
+    {
+      unindex_task_id (batch[i]);
+      batch[i]->removed = 1;
+      continue;
+    }
+    link_pipe_tasks (batch[i], peer, from);
+  }
+  for (i = n; i-- > 0; )
+    if (batch[i]->removed)
+      batch[i] = batch[--n];
+
+  reload_tasks = link_sorted_tasks (batch, n);
+  free (batch);
+  if (resolve_dependencies (reload_tasks, 1))
+    for (task = reload_tasks; task != NULL; task = task->next)
+    {
+      task->n_dependents = 0;
+      task->state = TASK_FAILED;
+    }
+  finish_reload ();
+
+  if (verbose)
+    MSG ("config reloaded in %lld ms: %u added, %u changed, %u removed\n",
+         monotonic_ms () - begin, n_added, n_changed, n_removed);
+
+  if (!reload_stopping)
+    start_reload_batch ();
+  return;
+
+no_memory:
+  MSG ("failed to reload config file '%s': %s\n", config_path, STRERROR);
+  if (config.data)
+    close_config (&config);
+  free (defs);
+  finish_reload ();
+}
+
+/* describe a wait status, or the lack of one. */
+static const char *
+describe_status (int   status,
+                 char *buf,
+                 size_t size)
+{
+  if (status < 0)
+    snprintf (buf, size, "-");
+  else if (WIFSIGNALED (status))
+    snprintf (buf, size, "signal %d", WTERMSIG (status));
+  else
+    snprintf (buf, size, "code %d", WEXITSTATUS (status));
+
+  return buf;
+}
+
+/* add up the resources used by a run of a task which has exited. */
+static void
+account_exit (Task          *task,
+              int            status,
+              struct rusage *ru)
+{
+  char buf[32];
+
+  task->status = status;
+  task->cpu_usec += (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000LL +
+                    ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+  if (ru->ru_maxrss > task->max_rss)
+    task->max_rss = ru->ru_maxrss;
+
+  if (verbose && !task->stop_at)
+    MSG ("program '%s' exited with %s (cpu %lld ms, max rss %ld KB, %u restarts)\n",
+         task->id, describe_status (status, buf, sizeof (buf)),
+         task->cpu_usec / 1000, task->max_rss, task->spawns ? task->spawns - 1 : 0);
+}
+
+/* print the resources used by every task. */
+static void
+report_usage (void)
+{
+  TaskChunk *chunk;
+  Task      *task;
+  char       buf[32];
+
+  MSG ("%-8s %8s %-10s %10s %12s\n", "task", "restarts", "exit", "cpu ms", "max rss KB");
+  FOR_EACH_TASK (chunk, task)
+    if (!task->removed)
+      MSG ("%-8s %8u %-10s %10lld %12ld\n", task->id, task->spawns ? task->spawns - 1 : 0,
+           describe_status (task->status, buf, sizeof (buf)),
+           task->cpu_usec / 1000, task->max_rss);
+}
+
+static int
+compare_stop_order (const void *a,
+                    const void *b)
+{
+  unsigned int order_a = (*(Task * const *) a)->order;
+  unsigned int order_b = (*(Task * const *) b)->order;
+
+  return order_a < order_b ? 1 : order_a > order_b ? -1 : 0;
+}
+
+/* kill every task which is still running, whatever its stage, and return
+ * how many there were. */
+static unsigned int
+kill_remaining (void)
+{
+  TaskChunk   *chunk;
+  Task        *task;
+  unsigned int i;
+  unsigned int n = 0;
+
+  FOR_EACH_LIVE_TASK (chunk, i, task)
+    if (!task->killed)
+    {
+      if (!task->stop_at)
+        task->stop_at = monotonic_ms ();
+      kill (task->pid, SIGKILL);
+      task->killed = 1;
+      n++;
+    }
+
+  n_killed += n;
+  stop_stage_end = n_stop_tasks;        // no stage is left to signal
+  stop_killing = 1;
+
+  return n;
+}
+
+/* wake up at the nearest of the stop timeouts of the tasks stopped by a
+ * reload, of the current stage and of the shutdown deadline, or never. */
+static void
+arm_stop_timer (void)
+{
+  struct itimerspec its;
+  long long         at;
+  unsigned int      i;
+  Task             *task;
+
+  at = shutdown_signo ? shutdown_begin + shutdown_timeout : 0;
+  for (i = stop_stage; i < stop_stage_end; i++)
+  {
+    task = stop_tasks[i];
+    if (task->stop_waited && !task->killed && task->stop_at + task->stop_timeout < at)
+      at = task->stop_at + task->stop_timeout;
+  }
+  for (task = reload_stops; task != NULL; task = task->stop_next)
+    if ((task->reload & RELOAD_STOPPING) && task->pid > 0 && !task->killed &&
+        (!at || task->stop_at + task->stop_timeout < at))
+      at = task->stop_at + task->stop_timeout;
+
+  memset (&its, 0x00, sizeof (its));
+  if (at)
+  {
+    its.it_value.tv_sec = at / 1000;
+    its.it_value.tv_nsec = (at % 1000) * 1000000 + 1;
+  }
+  if (timerfd_settime (stop_tfd, TFD_TIMER_ABSTIME, &its, NULL))
+    MSG ("failed to arm the stop timer: %s\n", STRERROR);
+}
+
+/* signal a task stopped by a reload, which is killed if it is still
+ * running after its stop-timeout. */
+static void
+stop_reloaded_task (Task *task)
+{
+  kill (task->pid, SIGTERM);
+  task->stop_at = monotonic_ms ();
+  task->stop_next = reload_stops;
+  reload_stops = task;
+  arm_stop_timer ();
+}
+
+/* signal the tasks of the next order, the highest first, until a stage
+ * has some running task to wait for. */
+static void
+stop_next_stage (void)
+{
+  long long now = monotonic_ms ();
+
+  while (!stop_pending && stop_stage_end < n_stop_tasks)
+  {
+    unsigned int order = stop_tasks[stop_stage_end]->order;
+
+    stop_stage = stop_stage_end;
+    for (; stop_stage_end < n_stop_tasks && stop_tasks[stop_stage_end]->order == order;
+         stop_stage_end++)
+    {
+      Task *task = stop_tasks[stop_stage_end];
+
+      if (task->pid <= 0)               // exited while a later stage stopped
+        continue;
+      if (0) MSG ("kill program[%s] pid[%d] by SIGNAL(%d)\n", task->id, task->pid, shutdown_signo);
+      kill (task->pid, shutdown_signo);
+      task->stop_at = now;
+      task->stop_waited = 1;
+      stop_pending++;
+    }
+  }
+
+  arm_stop_timer ();
+}
+
+/* stop a task a shard spawned as the shutdown began: it joins the stage
+ * being stopped, or waits for the stage of its order if that is to come. */
+static void
+stop_late_task (Task *task)
+{
+  Task       **grown;
+  unsigned int i = stop_stage_end;
+  int          later;
+
+  if (stop_killing)
+  {
+    kill (task->pid, SIGKILL);
+    task->stop_at = monotonic_ms ();
+    task->killed = 1;
+    n_killed++;
+    return;
+  }
+
+  grown = realloc (stop_tasks, (n_stop_tasks + 1) * sizeof (Task *));
+  if (!grown)
+  {
+    MSG ("failed to stop program '%s' in order: %s\n", task->id, STRERROR);
+    kill (task->pid, shutdown_signo);   // the shutdown deadline still holds
+    task->stop_at = monotonic_ms ();
+    return;
+  }
+  stop_tasks = grown;
+
+  later = stop_pending && task->order < stop_tasks[stop_stage]->order;
+  if (later)
+    while (i < n_stop_tasks && stop_tasks[i]->order >= task->order)
+      i++;
+  memmove (&stop_tasks[i + 1], &stop_tasks[i], (n_stop_tasks - i) * sizeof (Task *));
+  stop_tasks[i] = task;
+  n_stop_tasks++;
+  if (later)
+    return;
+
+  stop_stage_end++;
+  kill (task->pid, shutdown_signo);
+  task->stop_at = monotonic_ms ();
+  task->stop_waited = 1;
+  stop_pending++;
+  arm_stop_timer ();
+}
+
+/* a task has exited during the shutdown. */
+static void
+stopped_task (Task *task)
+{
+  if (verbose)
+    MSG ("program '%s' stopped in %lld ms%s\n", task->id,
+         monotonic_ms () - task->stop_at, task->killed ? ", killed" : "");
+
+  if (task->stop_waited)
+  {
+    task->stop_waited = 0;
+    if (--stop_pending == 0)
+      stop_next_stage ();
+  }
+}
+
+static void
+handle_stop_timer (Watch       *watch,
+                   unsigned int events)
+{
+  unsigned long long expirations;
+  long long          now;
+  unsigned int       n;
+  unsigned int       i;
+  Task              *task;
+
+  if (read (watch->fd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN)
+    MSG ("read\n");
+
+  now = monotonic_ms ();
+  for (task = reload_stops; task != NULL; task = task->stop_next)
+    if ((task->reload & RELOAD_STOPPING) && task->pid > 0 && !task->killed &&
+        now >= task->stop_at + task->stop_timeout)
+    {
+      MSG ("program '%s' did not stop in %u ms, killed\n", task->id, task->stop_timeout);
+      kill (task->pid, SIGKILL);
+      task->killed = 1;
+    }
+
+  if (shutdown_signo && now >= shutdown_begin + shutdown_timeout)
+  {
+    n = kill_remaining ();
+    if (n)
+      MSG ("%u tasks did not stop in %u ms, killed\n", n, shutdown_timeout);
+    return;
+  }
+
+  for (i = stop_stage; i < stop_stage_end; i++)
+  {
+    task = stop_tasks[i];
+    if (task->stop_waited && !task->killed && now >= task->stop_at + task->stop_timeout)
+    {
+      MSG ("program '%s' did not stop in %u ms, killed\n", task->id, task->stop_timeout);
+      kill (task->pid, SIGKILL);
+      task->killed = 1;
+      n_killed++;
+    }
+  }
+
+  arm_stop_timer ();
+}
+
+/* [new] stop every task, an order at a time from the highest one, and let
+ * the event loop reap them. a task still running after its stop-timeout,
+ * or every task once the shutdown deadline has passed, is killed. a second
+ * signal kills them right away. */
+static void
+terminate_children (int signo)
+{
+  TaskChunk   *chunk;
+  Task        *task;
+  unsigned int i;
+
+  if (0) MSG ("terminated by SIGNAL(%d)\n", signo);
+
+  if (shutdown_signo)
+  {
+    kill_remaining ();
+    return;
+  }
+
+  running = 0;
+  shutdown_signo = signo;
+  shutdown_begin = monotonic_ms ();
+
+  while (timer_heap_count)              // delayed respawns
+    pop_timer ()->state = TASK_IDLE;
+  arm_timer ();
+  close_listeners ();                   // no connection spawns a task any more
+
+  stop_tasks = malloc ((n_running + 1) * sizeof (Task *));
+  if (stop_tasks)
+  {
+    FOR_EACH_LIVE_TASK (chunk, i, task)
+      stop_tasks[n_stop_tasks++] = task;
+    qsort (stop_tasks, n_stop_tasks, sizeof (Task *), compare_stop_order);
+  }
+
+  if (!stop_tasks)
+  {
+    MSG ("failed to stop tasks in order: %s\n", STRERROR);
+    kill_remaining ();
+    return;
+  }
+
+  stop_next_stage ();
+}
+
+/* the process of a task has been reaped. */
+static void
+reap_task (Task          *task,
+           int            status,
+           struct rusage *ru)
+{
+  if (0) MSG ("program[%s] terminated\n", task->id);
+  account_exit (task, status, ru);
+  task->exited_at = monotonic_us ();
+  if (task->stop_at)
+  {
+    stopped_task (task);
+    task->stop_at = 0;                  // a reload may run it again
+    task->killed = 0;
+  }
+
+  if (task->state == TASK_STARTING)
+    finish_start (task);
+  set_task_pid (task, 0);
+  if (task->reload & RELOAD_STOPPING)
+    reload_stopped (task);
+  else if (running && task->listen && !task->removed)
+  {
+    /* a clean exit, or one it was stopped by when idle, is not a failure */
+    if ((WIFEXITED (status) && !WEXITSTATUS (status)) ||
+        (WIFSIGNALED (status) && WTERMSIG (status) == SIGTERM))
+      listen_task (task);
+    else
+      restart_task (task);
+  }
+  else if (running && task->action == ACTION_RESPAWN && !task->removed)
+    restart_task (task);
+}
+
+/* the pidfd of a task is readable once its process has exited. nothing
+ * else reaps it, so its pid cannot have been reused yet. */
+static void
+handle_exit (Watch       *watch,
+             unsigned int events)
+{
+  Task         *task = TASK_OF_WATCH (watch, exit_watch);
+  struct rusage ru;
+  pid_t         pid;
+  int           status;
+
+  pid = wait4 (task->pid, &status, WNOHANG, &ru);
+  if (pid == 0)
+    return;
+  if (pid < 0)
+  {
+    MSG ("failed to reap program '%s': %s\n", task->id, STRERROR);
+    status = -1;
+    memset (&ru, 0x00, sizeof (ru));
   }
 
-  *new_task = *task;
-  new_task->next = NULL;
+  remove_watch (watch);
+  close (watch->fd);
+  watch->fd = -1;
+  reap_task (task, status, &ru);
+}
 
-  if (!tasks)
-    tasks = new_task;
-  else
-  {
-    /* [new] appending task by the order */
-    Task *t = tasks;
+/* apply the spawns and exits reported by the shards, in their order. */
+static void
+handle_shards (Watch       *watch,
+               unsigned int events)
+{
+  unsigned long long count;
+  ShardEvent        *batch;
+  ShardEvent        *event;
+  ShardEvent        *last;
+  siginfo_t          info;
+
+  if (read (watch->fd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+    MSG ("read\n");
 
-    if (t->order > new_task->order) {             // find the task which is greater than 
-      new_task->next = t;                         // currently added task
-      tasks = new_task;                           // then insert in the linked list
-    } else {
-      while (t->next != NULL && t->next->order < new_task->order) t = t->next;
-      new_task->next = t->next;
-      t->next = new_task;
+  pthread_mutex_lock (&shard_lock);
+  batch = shard_events;
+  shard_events = shard_events_tail = NULL;
+  pthread_mutex_unlock (&shard_lock);
+
+  for (event = last = batch; event != NULL; last = event, event = event->next)
+    if (event->exited)
+    {
+      if (syscall (SYS_waitid, P_PIDFD, event->pidfd, &info, WEXITED | WNOHANG, NULL) < 0)
+        MSG ("failed to reap program '%s': %s\n", event->task->id, STRERROR);
+      close (event->pidfd);
+      reap_task (event->task, event->status, &event->ru);
     }
-  }
+    else
+    {
+      event->task->spawning = 0;
+      n_spawning--;
+      finish_spawn (event->task, event->pid, event->ready_fd);
+    }
+
+  if (!batch)
+    return;
+  pthread_mutex_lock (&shard_lock);
+  last->next = shard_free;
+  shard_free = batch;
+  pthread_mutex_unlock (&shard_lock);
 }
 
 static int
-read_config (const char *filename)
+start_shards (unsigned int n)
 {
-  FILE *fp;
-  char  line[COMMAND_LEN * 2];
-  int   line_nr;
+  unsigned int i;
 
-  fp = fopen (filename, "r");
-  if (!fp)
+  shards = calloc (n, sizeof (Shard));
+  shard_efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (!shards || shard_efd < 0 || add_watch (&shard_watch, shard_efd, EPOLLIN, handle_shards))
     return -1;
 
-  tasks = NULL;
-
-  line_nr = 0;
-  while (fgets (line, sizeof (line), fp))
+  for (i = 0; i < n; i++)
   {
-    Task   task;
-    char  *p;
-    char  *s;
-    size_t len;
-
-    line_nr++;
-    memset (&task, 0x00, sizeof (task));
+    Shard *shard = &shards[i];
 
-    len = strlen (line);
-    if (line[len - 1] == '\n')
-      line[len - 1] = '\0';
+    pthread_mutex_init (&shard->lock, NULL);
+    shard->epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (shard->epfd < 0 ||
+        add_watch_to (shard->epfd, &shard->wake_watch,
+                      eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC), EPOLLIN, NULL))
+      return -1;
 
-    if (0)
-      MSG ("config[%3d] %s\n", line_nr, line);
+    errno = pthread_create (&shard->thread, NULL, run_shard, shard);
+    if (errno)
+      return -1;
+    n_shards++;
+  }
 
-    strstrip (line);
+  return 0;
+}
 
-    /* comment or empty line */
-    if (line[0] == '#' || line[0] == '\0')
-      continue;
+/* without pidfds, reap whichever children SIGCHLD was sent for. */
+static void
+wait_for_children (int signo)
+{
+  struct rusage ru;
+  Task         *task;
+  pid_t         pid;
+  int           status;
+  int           n;
 
-    /* id */
-    s = line;
-    p = strchr (s, ':');
-    if (!p)
-      goto invalid_line;
-    *p = '\0';
-    strstrip (s);
-    if (check_valid_id (s))
-    {
-      MSG ("invalid id '%s' in line %d, ignored\n", s, line_nr);
-      continue;
-    }
-    if (lookup_task (s))
-    {
-      MSG ("duplicate id '%s' in line %d, ignored\n", s, line_nr);
-      continue;
-    }
-    strcpy (task.id, s);
-
-    /* action */
-    s = p + 1;
-    p = strchr (s, ':');
-    if (!p)
-      goto invalid_line;
-    *p = '\0';
-    strstrip (s);
-    if (!strcasecmp (s, "once"))
-      task.action = ACTION_ONCE;
-    else if (!strcasecmp (s, "respawn"))
-      task.action = ACTION_RESPAWN;
-    else
+  /* some SIGCHLD signals is lost or coalesced, so reap until empty.
+   * respawned children may exit as fast as they are reaped, so give the
+   * event loop a turn after a batch and resume from there. */
+  for (n = 0; n < EVENT_BATCH && (pid = wait4 (-1, &status, WNOHANG, &ru)) > 0; n++)
+  {
+    task = lookup_task_by_pid (pid);
+    if (!task)
     {
-      MSG ("invalid action '%s' in line %d, ignored\n", s, line_nr);
+      MSG ("unknown pid %d\n", pid);
       continue;
     }
 
-    /* [new] order */
-    s = p + 1;
-    p = strchr (s, ':');
-    if (!p)
-      goto invalid_line;
-    *p = '\0';
-    strstrip (s);
-    if (s[0] != '\0') 
-    {                   // when order was given as an option
-      if (check_valid_order (s)) {
-        MSG ("invalid order '%s' in line %d, ignored\n", s, line_nr);
-        continue;
-      }
-      task.order = atoi(s);        // set task order
-    } 
-    else                           // when no order was given
-    {                              
-      task.order = rand() % 10000; // give random task order
-    }
+    reap_task (task, status, &ru);
+  }
 
-    /* pipe-id */
-    s = p + 1;
-    p = strchr (s, ':');
-    if (!p)
-      goto invalid_line;
-    *p = '\0';
-    strstrip (s);
-    if (s[0] != '\0')
-    {
-      Task *t;
+  reap_pending = n == EVENT_BATCH;
+}
 
-      if (check_valid_id (s))
-      {
-        MSG ("invalid pipe-id '%s' in line %d, ignored\n", s, line_nr);
-        continue;
-      }
+/* [new] drain every pending signal in one read, then reap once. */
+static void
+handle_signals (Watch       *watch,
+                unsigned int events)
+{
+  struct signalfd_siginfo fdsi[EVENT_BATCH];
+  ssize_t                 s;
+  int                     reap;
+  int                     i;
 
-      t = lookup_task (s);
-      if (!t)
-      {
-        MSG ("unknown pipe-id '%s' in line %d, ignored\n", s, line_nr);
-        continue;
-      }
-      if (task.action == ACTION_RESPAWN || t->action == ACTION_RESPAWN)
-      {
-        MSG ("pipe not allowed for 'respawn' tasks in line %d, ignored\n", line_nr);
-        continue;
-      }
-      if (t->piped)
-      {
-        MSG ("pipe not allowed for already piped tasks in line %d, ignored\n", line_nr);
+  reap = 0;
+  for (;;)
+  {
+    s = read (watch->fd, fdsi, sizeof (fdsi));
+    if (s < 0)
+    {
+      if (errno == EINTR)
         continue;
-      }
-
-      strcpy (task.pipe_id, s);
-      task.piped = 1;
-      t->piped = 1;
+      if (errno != EAGAIN)
+        MSG ("read\n");
+      break;
     }
 
-    /* command */
-    s = p + 1;
-    strstrip (s);
-    if (s[0] == '\0')
+    for (i = 0; i < s / sizeof (struct signalfd_siginfo); i++)
     {
-      MSG ("empty command in line %d, ignored\n", line_nr);
-      continue;
+      if (fdsi[i].ssi_signo == SIGCHLD) {
+        reap = 1;
+      } else if (fdsi[i].ssi_signo == SIGINT) {
+        terminate_children(SIGINT);
+      } else if (fdsi[i].ssi_signo == SIGTERM) {
+        terminate_children(SIGTERM);
+      } else if (fdsi[i].ssi_signo == SIGPIPE) {
+        ;                                           // a relay lost its reader
+      } else if (fdsi[i].ssi_signo == SIGHUP) {
+        reload_pending = 1;                         // once startup is over
+      } else {
+        MSG ("read unexpected signal\n");
+      }
     }
-    strncpy (task.command, s, sizeof (task.command) - 1);
-    task.command[sizeof (task.command) - 1] = '\0';
-
-    if (0)
-      MSG ("id:%s pipe-id:%s action:%d command:%s\n",
-          task.id, task.pipe_id, task.action, task.command);
-
-    append_task (&task);
-    continue;
 
-invalid_line:
-    MSG ("invalid format in line %d, ignored\n", line_nr);
+    if (s < sizeof (fdsi))
+      break;
   }
 
-  fclose (fp);
-
-  return 0;
+  if (reap)
+    wait_for_children (SIGCHLD);
 }
 
-static char **
-make_command_argv (const char *str)
+static const char *state_names[] =
 {
-  char      **argv;
-  const char *p;
-  int         n;
+  "idle", "starting", "running", "backoff", "failed", "listening",
+};
 
-  for (n = 0, p = str; p != NULL; n++)
-  {
-    char *s;
+/* metrics with a sample for each task. */
+static const char *task_metrics[][3] =
+{
+  { "procman_task_state", "gauge", "State of the task, by the state label." },
+  { "procman_task_pid", "gauge", "Pid of the task, 0 if it is not running." },
+  { "procman_task_uptime_seconds", "gauge", "Time since the task was spawned, 0 if it is not running." },
+  { "procman_task_spawns_total", "counter", "Times the task has been spawned." },
+  { "procman_task_cpu_seconds_total", "counter", "User and system time of the exited runs of the task." },
+  { "procman_task_max_rss_bytes", "gauge", "Largest resident set of an exited run of the task." },
+};
 
-    s = strchr (p, ' ');
-    if (!s)
-      break;
-    p = s + 1;
-  }
-  n++;
+static void
+client_printf (Client     *client,
+               const char *format,
+               ...)
+{
+  va_list args;
+  int     len;
 
-  argv = calloc (sizeof (char *), n + 1);
-  if (!argv)
-  {
-    MSG ("failed to allocate a command vector: %s\n", STRERROR);
-    return NULL;
-  }
+  va_start (args, format);
+  len = vsnprintf (client->buf + client->len, METRICS_BUF - client->len, format, args);
+  va_end (args);
 
-  for (n = 0, p = str; p != NULL; n++)
-  {
-    char *s;
+  if (len > 0)
+    client->len += len < METRICS_BUF - client->len ? len : METRICS_BUF - client->len - 1;
+}
 
-    s = strchr (p, ' ');
-    if (!s)
-      break;
-    argv[n] = strndup (p, s - p);
-    p = s + 1;
-  }
-  argv[n] = strdup (p);
+static void
+format_histogram (Client     *client,
+                  const char *name,
+                  const char *help,
+                  Histogram  *histogram)
+{
+  unsigned long long count = 0;
+  int                i;
 
-  if (0)
+  client_printf (client, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
   {
-
-    MSG ("command:%s\n", str);
-    for (n = 0; argv[n] != NULL; n++)
-      MSG ("  argv[%d]:%s\n", n, argv[n]);
+    count += histogram->buckets[i];
+    client_printf (client, "%s_bucket{le=\"%g\"} %llu\n", name, histogram_bounds[i] / 1e6, count);
   }
+  client_printf (client, "%s_bucket{le=\"+Inf\"} %llu\n", name, histogram->count);
+  client_printf (client, "%s_sum %.6f\n%s_count %llu\n", name, histogram->sum / 1e6,
+                 name, histogram->count);
+}
 
-  return argv;
+static void
+format_globals (Client *client)
+{
+  client_printf (client, "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n\r\n");
+  client_printf (client, "# HELP procman_uptime_seconds Time since procman was started.\n"
+                 "# TYPE procman_uptime_seconds gauge\n"
+                 "procman_uptime_seconds %.3f\n", (monotonic_ms () - procman_started_at) / 1e3);
+  client_printf (client, "# HELP procman_tasks Tasks in the config.\n"
+                 "# TYPE procman_tasks gauge\nprocman_tasks %u\n", id_table_count);
+  client_printf (client, "# HELP procman_tasks_running Tasks with a live process.\n"
+                 "# TYPE procman_tasks_running gauge\nprocman_tasks_running %u\n", n_running);
+  client_printf (client, "# HELP procman_loop_turns_total Turns of the event loop.\n"
+                 "# TYPE procman_loop_turns_total counter\nprocman_loop_turns_total %llu\n",
+                 loop_turns);
+  format_histogram (client, "procman_loop_lag_seconds",
+                    "Time to dispatch a batch of events, the longest an event waits behind others.",
+                    &loop_lag);
+  format_histogram (client, "procman_respawn_latency_seconds",
+                    "Time from the exit of a task to its respawn, backoff included.",
+                    &respawn_latency);
 }
 
 static void
-spawn_task (Task *task)
+format_task (Client *client,
+             Task   *task)
 {
-  if (0) MSG ("spawn program '%s'...\n", task->id);
+  const char *name = task_metrics[client->family - 1][0];
 
-  if (task->piped && task->pipe_id[0] == '\0')  // task, who are piped, makes pipe file a and b
+  switch (client->family)
   {
-    if (pipe (task->pipe_a))
-    {
-      task->piped = 0;
-      MSG ("failed to pipe() for prgoram '%s': %s\n", task->id, STRERROR);
-    }
-    if (pipe (task->pipe_b))
-    {
-      task->piped = 0;
-      MSG ("failed to pipe() for prgoram '%s': %s\n", task->id, STRERROR);
-    }
+  case 1:
+    client_printf (client, "%s{task=\"%s\",state=\"%s\"} 1\n", name, task->id,
+                   state_names[task->state]);
+    break;
+  case 2:
+    client_printf (client, "%s{task=\"%s\"} %d\n", name, task->id, task->pid > 0 ? task->pid : 0);
+    break;
+  case 3:
+    client_printf (client, "%s{task=\"%s\"} %.3f\n", name, task->id,
+                   task->pid > 0 ? (monotonic_ms () - task->started_at) / 1e3 : 0.0);
+    break;
+  case 4:
+    client_printf (client, "%s{task=\"%s\"} %u\n", name, task->id, task->spawns);
+    break;
+  case 5:
+    client_printf (client, "%s{task=\"%s\"} %.6f\n", name, task->id, task->cpu_usec / 1e6);
+    break;
+  case 6:
+    client_printf (client, "%s{task=\"%s\"} %ld\n", name, task->id, task->max_rss * 1024);
+    break;
   }
+}
 
-  task->pid = fork ();
-  if (task->pid < 0)
-  {
-    MSG ("failed to fork() for program '%s': %s\n", task->id, STRERROR);
-    return;
-  }
+/* format the next slice of the metrics, returning 0 once all have been. */
+static int
+fill_client (Client *client)
+{
+  Task        *task;
+  unsigned int n;
 
-  /* child process */
-  if (task->pid == 0)
+  client->len = client->sent = 0;
+  for (n = 0; n < METRICS_SLICE; )
   {
-    char **argv;
-
-    argv = make_command_argv (task->command);
-    if (!argv || !argv[0])
-    {
-      MSG ("failed to parse command '%s'\n", task->command);
-      exit (-1);
-    }
-
-    if (task->piped)
+    if (!client->chunk || client->index == client->chunk->used)
     {
-      if (task->pipe_id[0] == '\0') // who are piped
+      if (client->chunk && client->chunk->next)
       {
-        dup2 (task->pipe_a[1], 1);  // write to pipe_a file
-        dup2 (task->pipe_b[0], 0);  // read from pipe_b file
-        close (task->pipe_a[0]);
-        close (task->pipe_a[1]);
-        close (task->pipe_b[0]);
-        close (task->pipe_b[1]);
+        client->chunk = client->chunk->next;
+        client->index = 0;
+        continue;
       }
-      else                          // who did pipe
-      {
-        Task *sibling;
 
-        sibling = lookup_task (task->pipe_id); // object to whom piped are sibling not child.
-        if (sibling && sibling->piped)
-        {
-          dup2 (sibling->pipe_a[0], 0);  // read from pipe_a file
-          dup2 (sibling->pipe_b[1], 1);  // write to pipe_b file
-          close (sibling->pipe_a[0]);
-          close (sibling->pipe_a[1]);
-          close (sibling->pipe_b[0]);
-          close (sibling->pipe_b[1]);
-        }
-      }
+      if (client->family == sizeof (task_metrics) / sizeof (task_metrics[0]))
+        break;
+      client->family++;
+      client->chunk = task_chunks;
+      client->index = 0;
+      client_printf (client, "# HELP %s %s\n# TYPE %s %s\n",
+                     task_metrics[client->family - 1][0], task_metrics[client->family - 1][2],
+                     task_metrics[client->family - 1][0], task_metrics[client->family - 1][1]);
+      if (!client->chunk)
+        continue;
     }
 
-    if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1) // [new] unblock signals before executed.
-      MSG (" sigprocmask \n ");
-
-    execvp (argv[0], argv);
-    MSG ("failed to execute command '%s': %s\n", task->command, STRERROR);
-    exit (-1);
+    task = &client->chunk->tasks[client->index++];
+    if (task->removed)
+      continue;
+    format_task (client, task);
+    n++;
   }
-  usleep(100000); // for execute child in order, we should wait for a bit.
+
+  return client->len > 0;
 }
 
 static void
-spawn_tasks (void)
+close_client (Client *client)
 {
-  Task *task;
+  remove_watch (&client->watch);
+  close (client->watch.fd);
+  n_clients--;
 
-  for (task = tasks; task != NULL && running; task = task->next)
-    spawn_task (task);
+  /* events of this batch may still point to it */
+  client->watch.fd = -1;
+  client->next = closed_clients;
+  closed_clients = client;
 }
 
 static void
-wait_for_children (int signo)
+handle_client (Watch       *watch,
+               unsigned int events)
 {
-  Task *task;
-  pid_t pid;
+  Client *client = (Client *) ((char *) watch - offsetof (Client, watch));
+  ssize_t n;
 
-rewait:
-  pid = waitpid (-1, NULL, WNOHANG);
-  if (pid <= 0)
+  if (events & EPOLLERR)
+  {
+    close_client (client);
     return;
+  }
 
-  task = lookup_task_by_pid (pid);
-  if (!task)
+  /* a socket closed with unread data resets the peer, so read the
+   * request up to its end before closing */
+  if (client->done)
   {
-    MSG ("unknown pid %d", pid);
+    n = recv (watch->fd, client->buf, METRICS_BUF, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN))
+      close_client (client);
     return;
   }
 
-  if (0) MSG ("program[%s] terminated\n", task->id);
-
-  if (running && task->action == ACTION_RESPAWN)
-    spawn_task (task);
-  else
-    task->pid = 0;
+  if (client->sent == client->len && !fill_client (client))
+  {
+    client->done = 1;
+    shutdown (watch->fd, SHUT_WR);
+    modify_watch (watch, EPOLLIN);
+    return;
+  }
 
-  /* some SIGCHLD signals is lost... */
-  goto rewait;
+  n = send (watch->fd, client->buf + client->sent, client->len - client->sent, MSG_NOSIGNAL);
+  if (n < 0)
+  {
+    if (errno != EAGAIN)
+      close_client (client);
+    return;
+  }
+  client->sent += n;
 }
 
+/* accept scrapes; the metrics are sent as the sockets become writable. */
 static void
-terminate_children (int signo)
+handle_metrics (Watch       *watch,
+                unsigned int events)
 {
-  Task *task;
+  Client *client;
+  int     fd;
+  int     n;
 
-  if (0) MSG ("terminated by SIGNAL(%d)\n", signo);
+  for (n = 0; n < EVENT_BATCH; n++)
+  {
+    fd = accept4 (watch->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        MSG ("failed to accept a metrics client: %s\n", STRERROR);
+      break;
+    }
 
-  running = 0;
+    client = n_clients < METRICS_CLIENTS_MAX ? malloc (sizeof (Client)) : NULL;
+    if (!client)
+    {
+      close (fd);
+      continue;
+    }
+    client->family = 0;
+    client->chunk = NULL;
+    client->index = 0;
+    client->len = client->sent = 0;
+    client->done = 0;
+    format_globals (client);
 
-  for (task = tasks; task != NULL; task = task->next)
-    if (task->pid > 0)
+    if (add_watch (&client->watch, fd, EPOLLOUT, handle_client))
     {
-      if (0) MSG ("kill program[%s] pid[%d] by SIGNAL(%d)\n", task->id, task->pid, signo);
-      kill (task->pid, signo);
+      close (fd);
+      free (client);
+      continue;
     }
+    n_clients++;
+  }
+}
+
+static int
+open_metrics (const char *path)
+{
+  struct sockaddr_un addr;
+  int                fd;
 
-  close(sfd); // [new] close signal file descriptor before terminate procman process
+  memset (&addr, 0x00, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy (addr.sun_path, path);
+
+  if (unlink_socket (path))             // left over by a previous run
+    return -1;
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+      listen (fd, METRICS_CLIENTS_MAX) ||
+      add_watch (&metrics_watch, fd, EPOLLIN, handle_metrics))
+  {
+    close (fd);
+    return -1;
+  }
 
-  exit (1);
+  return 0;
 }
 
 int
@@ -514,73 +5967,260 @@ main (int    argc,
     char **argv)
 {
   int terminated;
-  struct signalfd_siginfo fdsi;
-  ssize_t s;
-  Task *task;
+  struct epoll_event events[EVENT_BATCH];
+  int n;
+  int i;
+  int opt;
+  const char *log_path = NULL;
+  int use_cache = 0;
+  unsigned int n_workers = 0;
 
   srand(time(NULL));     // [new] make random seed
+  procman_started_at = monotonic_ms ();
+
+  while ((opt = getopt (argc, argv, "b:e:vl:L:r:c:m:Cj:k:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      if (!strcmp (optarg, "fork"))
+        spawn_backend = SPAWN_FORK;
+      else if (!strcmp (optarg, "spawn"))
+        spawn_backend = SPAWN_POSIX;
+      else
+      {
+        MSG ("invalid spawn backend '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case 'e':
+      if (!strcmp (optarg, "epoll"))
+        loop_backend = LOOP_EPOLL;
+      else if (!strcmp (optarg, "uring"))
+        loop_backend = LOOP_URING;
+      else
+      {
+        MSG ("invalid event loop backend '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'l':
+      log_path = optarg;
+      break;
+    case 'L':
+      log_dir = optarg;
+      break;
+    case 'c':
+      cgroup_root = optarg;
+      break;
+    case 'm':
+      metrics_path = optarg;
+      break;
+    case 'C':
+      use_cache = 1;
+      break;
+    case 'k':
+      if (parse_duration (optarg, &shutdown_timeout))
+      {
+        MSG ("invalid shutdown timeout '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case 'j':
+      if (parse_number (optarg, &n_workers) || n_workers > 1024)
+      {
+        MSG ("invalid number of threads '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case 'r':
+      if (parse_size (optarg, &log_rotate))
+      {
+        MSG ("invalid log size '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    default:
+      optind = argc;
+      break;
+    }
+  }
 
-  if (argc <= 1)
+  if (optind >= argc || (log_path && log_dir))
   {
-    MSG ("usage: %s config-file\n", argv[0]);
+    MSG ("usage: %s [-v] [-C] [-b fork|spawn] [-e epoll|uring] [-j threads]\n"
+         "       [-k shutdown-timeout] [-l file | -L dir] [-r size] [-c cgroup-dir]\n"
+         "       [-m metrics-socket] config-file\n", argv[0]);
     return -1;
   }
 
-  if (read_config (argv[1]))
+  if (use_cache && asprintf (&cache_path, "%s.cache", argv[optind]) < 0)
+    cache_path = NULL;
+
+  config_path = argv[optind];
+  if (read_config (config_path))
   {
-    MSG ("failed to load config file '%s': %s\n", argv[1], STRERROR);
+    MSG ("failed to load config file '%s': %s\n", argv[optind], STRERROR);
     return -1;
   }
+  pool_kept = pool_used;
 
   running = 1;
 
   /* [new] get signal file descriptor from signalfd() */
 
+  /* [new] children are watched by pidfds where the kernel has them */
+  n = syscall (SYS_pidfd_open, getpid (), 0);
+  if (n >= 0)
+  {
+    use_pidfd = 1;
+    close (n);
+  }
+
   sigemptyset(&mask);                                     // making a mask for signalfd()
-  sigaddset(&mask, SIGCHLD);                              // caller wish to accept these signals
+  if (!use_pidfd)
+    sigaddset(&mask, SIGCHLD);                            // caller wish to accept these signals
   sigaddset(&mask, SIGINT);
   sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGPIPE);                              // [new] for relays, unblocked in tasks
+  sigaddset(&mask, SIGHUP);                               // [new] reload the config
 
   if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)          // block signals to prevent
     MSG ("sigprocmask\n");                                // being handled by default action
 
-  sfd = signalfd(-1, &mask, SFD_CLOEXEC);                 // get signal file descriptor
+  sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);  // get signal file descriptor
   if (sfd == -1)
     MSG ("signalfd\n");
 
+  if (loop_backend == LOOP_URING && setup_uring (URING_ENTRIES))
+  {
+    MSG ("failed to set up io_uring, using epoll: %s\n", STRERROR);
+    loop_backend = LOOP_EPOLL;
+  }
+
+  tfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  stop_tfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (epfd < 0 || tfd < 0 || stop_tfd < 0 ||
+      add_watch (&signal_watch, sfd, EPOLLIN, handle_signals) ||
+      add_watch (&timer_watch, tfd, EPOLLIN, handle_timer) ||
+      add_watch (&stop_watch, stop_tfd, EPOLLIN, handle_stop_timer))
+  {
+    MSG ("failed to create event loop: %s\n", STRERROR);
+    return -1;
+  }
+
+  /* after blocking signals, so that the writer thread never takes them */
+  if ((log_path || log_dir) && start_logs (log_path))
+  {
+    MSG ("failed to start logging: %s\n", STRERROR);
+    return -1;
+  }
+
+  if (metrics_path && open_metrics (metrics_path))
+  {
+    MSG ("failed to open metrics socket '%s': %s\n", metrics_path, STRERROR);
+    return -1;
+  }
+
+  if (n_workers && !use_pidfd)
+    MSG ("no pidfds to reap by, spawning on one thread\n");
+  else if (n_workers && start_shards (n_workers))
+  {
+    MSG ("failed to start the spawning threads: %s\n", STRERROR);
+    return -1;
+  }
+
+  setup_cgroups ();
   spawn_tasks();
 
-  terminated = 0;
+  terminated = !n_running && !timer_heap_count && !stage_next && !start_queue &&
+               !reload_tasks && !n_spawning && !n_listening;
   while (!terminated)
   {
-    /* [new] read signal & handle by user defined handler */
-    s = read(sfd, &fdsi, sizeof(struct signalfd_siginfo));  // read signal from sfd
+    long long turn_start;
 
-    if (s != sizeof(struct signalfd_siginfo))
-      MSG ("read\n");
+    /* [new] block until some fd is ready, then dispatch every event */
+    n = wait_events (events, EVENT_BATCH, reap_pending ? 0 : -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      MSG ("failed to wait for events: %s\n", STRERROR);
+      break;
+    }
+    turn_start = monotonic_us ();
+
+    for (i = 0; i < n; i++)
+    {
+      Watch *watch = events[i].data.ptr;
 
-    if (fdsi.ssi_signo == SIGCHLD) {                        
-      wait_for_children(SIGCHLD);
-    } else if (fdsi.ssi_signo == SIGINT) {
-      terminate_children(SIGINT);
-    } else if (fdsi.ssi_signo == SIGTERM) {
-      terminate_children(SIGTERM);
-    } else {
-      MSG ("read unexpected signal\n");
+      if (watch->fd >= 0)               // not closed by an earlier event
+        watch->func (watch, events[i].events);
     }
 
+    while (closed_relays)
+    {
+      Relay *relay = closed_relays;
 
-    terminated = 1;
-    for (task = tasks; task != NULL; task = task->next)
-      if (task->pid > 0)
-      {
-        terminated = 0;
-        break;
-      }
+      closed_relays = relay->next;
+      free (relay);
+    }
+
+    while (closed_clients)
+    {
+      Client *client = closed_clients;
+
+      closed_clients = client->next;
+      free (client);
+    }
+
+    if (reap_pending)
+      wait_for_children (SIGCHLD);
+
+    flush_start_queue ();
 
-    usleep (100000);
+    /* the strings the reloads left behind are compacted once the startup,
+     * or a reload, is over, ahead of a pending reload so a stream of them
+     * never defers it */
+    if (pool_used > 2 * pool_kept + STRING_CHUNK_SIZE && !stage_next && !stage_pending &&
+        !n_unstarted && !reload_stopping && !reload_tasks && !n_spawning && running)
+      compact_string_pool ();
 
+    /* a reload waits for the startup, or the previous reload, to be over */
+    if (reload_pending && !stage_next && !stage_pending && !n_unstarted &&
+        !reload_stopping && !reload_tasks && running)
+    {
+      reload_pending = 0;
+      reload_config ();
+    }
+
+    flush_logs ();
+
+    observe (&loop_lag, monotonic_us () - turn_start);
+    loop_turns++;
+
+    terminated = !n_running && !timer_heap_count && !stage_next && !start_queue &&
+               !reload_tasks && !n_spawning && !n_listening;
+    if (shutdown_signo)
+      terminated = !n_running && !n_spawning;
   }
 
-  return 0;
+  if (shutdown_signo && verbose)
+    MSG ("all tasks stopped in %lld ms, %u killed\n",
+         monotonic_ms () - shutdown_begin, n_killed);
+
+  close_listeners ();
+  stop_logs ();
+  if (metrics_path)
+    unlink_bound_socket (metrics_watch.fd);
+  if (cgroup_root_fd >= 0)
+    remove_cgroups ();
+  if (verbose)
+    report_usage ();
+
+  return shutdown_signo ? 1 : 0;
 }
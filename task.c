@@ -7,12 +7,41 @@
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 
 #define MSG(x...) fprintf (stderr, x)
+#define IO_SIZE   (1 << 20)
 
 static char        *name = "Task";
 static volatile int looping;
 
+static double
+now_sec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parse a size with an optional K, M or G suffix. */
+static long long
+parse_size (const char *str)
+{
+  char      *end;
+  long long  size;
+
+  size = strtoll (str, &end, 10);
+  switch (*end)
+    {
+    case 'G': size <<= 10;  /* fall through */
+    case 'M': size <<= 10;  /* fall through */
+    case 'K': size <<= 10;
+    }
+
+  return size;
+}
+
 static void
 signal_handler (int signo)
 {
@@ -31,12 +60,15 @@ main (int    argc,
   int   timeout    = 0;
   int   read_stdin = 0;
   char *msg_stdout = NULL;
+  long long stream_stdout = 0;
+  int   drain_stdin = 0;
+  int   copy_stdin = 0;
 
   /* Parse command line arguments. */
   {
     int opt;
 
-    while ((opt = getopt (argc, argv, "n:t:w:r")) != -1)
+    while ((opt = getopt (argc, argv, "n:t:w:rs:dc")) != -1)
       {
 	switch (opt)
 	  {
@@ -52,8 +84,17 @@ main (int    argc,
 	  case 'w':
 	    msg_stdout = optarg;
 	    break;
+	  case 's':
+	    stream_stdout = parse_size (optarg);
+	    break;
+	  case 'd':
+	    drain_stdin = 1;
+	    break;
+	  case 'c':
+	    copy_stdin = 1;
+	    break;
 	  default:
-	    MSG ("usage: %s [-n name] [-t timeout] [-r] [-w msg]\n", argv[0]);
+	    MSG ("usage: %s [-n name] [-t timeout] [-r] [-w msg] [-s size] [-d] [-c]\n", argv[0]);
 	    return -1;
 	  }
       }
@@ -109,6 +150,63 @@ main (int    argc,
 	}
     }
 
+  /* Stream the given number of bytes to standard output, in lines of 64
+     bytes. */
+  if (stream_stdout > 0)
+    {
+      static char buf[IO_SIZE];
+      long long   left;
+      ssize_t     len;
+      int         i;
+
+      memset (buf, 'x', sizeof (buf));
+      for (i = 63; i < sizeof (buf); i += 64)
+	buf[i] = '\n';
+      for (left = stream_stdout; left > 0; left -= len)
+	{
+	  len = write (1, buf, left < sizeof (buf) ? left : sizeof (buf));
+	  if (len <= 0)
+	    break;
+	}
+      close (1);
+    }
+
+  /* Copy standard input to standard output, as a pipeline stage. */
+  if (copy_stdin)
+    {
+      static char buf[IO_SIZE];
+      ssize_t     len;
+      ssize_t     done;
+      ssize_t     n;
+
+      while ((len = read (0, buf, sizeof (buf))) > 0)
+	{
+	  for (done = 0; done < len; done += n)
+	    if ((n = write (1, buf + done, len - done)) <= 0)
+	      break;
+	  if (done < len)
+	    break;
+	}
+      close (1);
+    }
+
+  /* Drain standard input and report the throughput. */
+  if (drain_stdin)
+    {
+      static char buf[IO_SIZE];
+      long long   total = 0;
+      double      start = now_sec ();
+      double      elapsed;
+      ssize_t     len;
+
+      while ((len = read (0, buf, sizeof (buf))) > 0)
+	total += len;
+
+      elapsed = now_sec () - start;
+      MSG ("'%s' drained %lld bytes in %.3f s (%.1f MB/s)\n", name, total,
+	   elapsed, elapsed > 0 ? total / elapsed / (1 << 20) : 0);
+    }
+
   /* Loop */
   while (looping && timeout != 0)
     {